@@ -0,0 +1,121 @@
+/* green - the PDF reader
+ * Copyright (C) 2009 Florian Tobias Schandinat
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 3.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+// prints the megapixels per second the blit kernels of every instruction set
+// convert into each display format, straight and rotated; run by make bench
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <SDL.h>
+#include "blit.h"
+
+
+#define BENCH_SIZE	1024	// edge of the square page and display
+#define BENCH_TIME	0.5	// seconds each measurement runs at least
+
+
+typedef struct
+{
+	const char	*name;
+	int	bpp;
+	Uint32	rmask, gmask, bmask;
+	
+}	BenchFormat;
+
+
+const BenchFormat	bench_formats[] = {
+	{"XRGB8888", 32, 0xFF0000, 0x00FF00, 0x0000FF},
+	{"XBGR8888", 32, 0x0000FF, 0x00FF00, 0xFF0000},
+	{"RGB565", 16, 0xF800, 0x07E0, 0x001F}};
+const char	*bench_isas[] = {"scalar", "sse2", "avx2", "neon"};
+
+
+double	BenchNow( void )
+{
+	struct timespec	ts;
+	
+	clock_gettime( CLOCK_MONOTONIC, &ts );
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// blits the whole page over and over for BENCH_TIME, returns MP/s
+double	BenchRun( SDL_Surface *display, BlitInfo *blit )
+{
+	double	start = BenchNow(), elapsed;
+	long	runs = 0;
+	
+	do
+	{
+		BlitCopy( display, blit );
+		runs++;
+		elapsed = BenchNow() - start;
+	}
+	while (elapsed < BENCH_TIME);
+	
+	return (double)runs * blit->rect.w * blit->rect.h / elapsed / 1e6;
+}
+
+int	main( int argc, char *argv[] )
+{
+	SDL_Surface	*display;
+	BlitInfo	straight, rotated;
+	Uint32	*page;
+	int	i, j, stride = BENCH_SIZE * 4;
+	
+	if (!(page = malloc( (size_t)BENCH_SIZE * stride )))
+		return 1;
+	
+	srand( 1 );
+	for (i = 0; i < BENCH_SIZE * BENCH_SIZE; i++)
+		page[i] = 0xFF000000 | (rand() & 0xFFFFFF);
+	
+	straight.rect.x = straight.rect.y = 0;
+	straight.rect.w = straight.rect.h = BENCH_SIZE;
+	straight.src = (Uint8*)page;
+	straight.step_x = 4;
+	straight.step_y = stride;
+	
+	// rotated right by 90°: display columns walk up the page
+	rotated = straight;
+	rotated.src = (Uint8*)page + (BENCH_SIZE - 1) * stride;
+	rotated.step_x = -stride;
+	rotated.step_y = 4;
+	
+	printf( "%-8s %-10s %12s %12s\n", "kernel", "format", "straight", "rotated" );
+	for (i = 0; i < sizeof( bench_isas ) / sizeof( *bench_isas ); i++)
+		for (j = 0; j < sizeof( bench_formats ) / sizeof( *bench_formats ); j++)
+		{
+			if (!BlitSelect( bench_isas[i] ))
+			{
+				printf( "%-8s %-10s %12s %12s\n", bench_isas[i], bench_formats[j].name, "n/a", "n/a" );
+				continue;
+			}
+			
+			display = SDL_CreateRGBSurface( SDL_SWSURFACE, BENCH_SIZE, BENCH_SIZE, bench_formats[j].bpp,
+				bench_formats[j].rmask, bench_formats[j].gmask, bench_formats[j].bmask, 0 );
+			if (!display)
+				return 1;
+			
+			printf( "%-8s %-10s %7.1f MP/s %7.1f MP/s\n", bench_isas[i], bench_formats[j].name,
+				BenchRun( display, &straight ), BenchRun( display, &rotated ) );
+			SDL_FreeSurface( display );
+		}
+	
+	free( page );
+	return 0;
+}
@@ -0,0 +1,722 @@
+/* green - the PDF reader
+ * Copyright (C) 2009 Florian Tobias Schandinat
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 3.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <SDL.h>
+#include "blit.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define BLIT_X86
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+#define BLIT_NEON
+#endif
+
+
+// destination formats with dedicated conversion kernels
+typedef enum
+{
+	FORMAT_GENERIC, FORMAT_XRGB8888, FORMAT_XBGR8888, FORMAT_RGB565
+	
+}	BlitFormat;
+
+// converts n ARGB32 pixels, walking the source forward (dir 1) or backward (dir -1)
+typedef void	(*RowFunc)( Uint8 *dst, const Uint8 *src, int n, int dir );
+
+// converts a transposed 4x4 block: display columns are step_x apart in the
+// source, display rows are neighbouring source pixels in direction dir
+typedef void	(*Tile4Func)( Uint8 *dst, int pitch, const Uint8 *src, int step_x, int dir );
+
+
+#define BLIT_BLOCK	16	// edge of the blocks rotated blits are split into
+
+
+void	RowXRGBScalar( Uint8 *dst, const Uint8 *src, int n, int dir )
+{
+	const Uint32	*s = (const Uint32*)src;
+	Uint32	*d = (Uint32*)dst;
+	int	i;
+	
+	for (i = 0; i < n; i++, s += dir)
+		d[i] = *s & 0xFFFFFF;
+	
+	return;
+}
+
+void	RowXBGRScalar( Uint8 *dst, const Uint8 *src, int n, int dir )
+{
+	const Uint32	*s = (const Uint32*)src;
+	Uint32	*d = (Uint32*)dst;
+	int	i;
+	
+	for (i = 0; i < n; i++, s += dir)
+		d[i] = ((*s>>16)&0xFF) | (*s&0xFF00) | ((*s&0xFF)<<16);
+	
+	return;
+}
+
+void	RowRGB565Scalar( Uint8 *dst, const Uint8 *src, int n, int dir )
+{
+	const Uint32	*s = (const Uint32*)src;
+	Uint16	*d = (Uint16*)dst;
+	int	i;
+	
+	for (i = 0; i < n; i++, s += dir)
+		d[i] = ((*s>>8)&0xF800) | ((*s>>5)&0x07E0) | ((*s>>3)&0x001F);
+	
+	return;
+}
+
+#ifdef	BLIT_X86
+__attribute__((target("sse2"))) inline static
+__m128i	Load4SSE2( const Uint8 *src, int dir )
+{
+	if (dir > 0)
+		return _mm_loadu_si128( (const __m128i*)src );
+	
+	return _mm_shuffle_epi32( _mm_loadu_si128( (const __m128i*)(src - 12) ), 0x1B );
+}
+
+__attribute__((target("sse2"))) inline static
+__m128i	ToXRGBSSE2( __m128i v )
+{
+	return _mm_and_si128( v, _mm_set1_epi32( 0xFFFFFF ) );
+}
+
+__attribute__((target("sse2"))) inline static
+__m128i	ToXBGRSSE2( __m128i v )
+{
+	const __m128i	ff = _mm_set1_epi32( 0xFF );
+	
+	return _mm_or_si128( _mm_or_si128( _mm_and_si128( _mm_srli_epi32( v, 16 ), ff ),
+		_mm_slli_epi32( _mm_and_si128( v, ff ), 16 ) ), _mm_and_si128( v, _mm_set1_epi32( 0xFF00 ) ) );
+}
+
+__attribute__((target("sse2")))
+void	RowXRGBSSE2( Uint8 *dst, const Uint8 *src, int n, int dir )
+{
+	int	i;
+	
+	for (i = 0; i + 4 <= n; i += 4, src += 16 * dir)
+		_mm_storeu_si128( (__m128i*)(dst + i * 4), ToXRGBSSE2( Load4SSE2( src, dir ) ) );
+	
+	RowXRGBScalar( dst + i * 4, src, n - i, dir );
+	return;
+}
+
+__attribute__((target("sse2")))
+void	RowXBGRSSE2( Uint8 *dst, const Uint8 *src, int n, int dir )
+{
+	int	i;
+	
+	for (i = 0; i + 4 <= n; i += 4, src += 16 * dir)
+		_mm_storeu_si128( (__m128i*)(dst + i * 4), ToXBGRSSE2( Load4SSE2( src, dir ) ) );
+	
+	RowXBGRScalar( dst + i * 4, src, n - i, dir );
+	return;
+}
+
+__attribute__((target("sse2"))) inline static
+__m128i	To565SSE2( __m128i v )
+{
+	v = _mm_or_si128( _mm_or_si128( _mm_and_si128( _mm_srli_epi32( v, 8 ), _mm_set1_epi32( 0xF800 ) ),
+		_mm_and_si128( _mm_srli_epi32( v, 5 ), _mm_set1_epi32( 0x07E0 ) ) ),
+		_mm_and_si128( _mm_srli_epi32( v, 3 ), _mm_set1_epi32( 0x001F ) ) );
+	
+	// sign extend, so the saturating pack keeps all 16 bits
+	return _mm_srai_epi32( _mm_slli_epi32( v, 16 ), 16 );
+}
+
+__attribute__((target("sse2")))
+void	RowRGB565SSE2( Uint8 *dst, const Uint8 *src, int n, int dir )
+{
+	int	i;
+	
+	for (i = 0; i + 8 <= n; i += 8, src += 32 * dir)
+		_mm_storeu_si128( (__m128i*)(dst + i * 2), _mm_packs_epi32(
+			To565SSE2( Load4SSE2( src, dir ) ), To565SSE2( Load4SSE2( src + 16 * dir, dir ) ) ) );
+	
+	RowRGB565Scalar( dst + i * 2, src, n - i, dir );
+	return;
+}
+
+// loads four source columns and returns them as four display rows
+__attribute__((target("sse2"))) inline static
+void	Transpose4SSE2( const Uint8 *src, int step_x, int dir, __m128i *row )
+{
+	__m128i	t0, t1, t2, t3;
+	
+	t0 = Load4SSE2( src, dir );
+	t1 = Load4SSE2( src + step_x, dir );
+	t2 = Load4SSE2( src + 2 * step_x, dir );
+	t3 = Load4SSE2( src + 3 * step_x, dir );
+	row[0] = _mm_unpacklo_epi32( t0, t1 );
+	row[1] = _mm_unpacklo_epi32( t2, t3 );
+	row[2] = _mm_unpackhi_epi32( t0, t1 );
+	row[3] = _mm_unpackhi_epi32( t2, t3 );
+	t0 = _mm_unpacklo_epi64( row[0], row[1] );
+	t1 = _mm_unpackhi_epi64( row[0], row[1] );
+	t2 = _mm_unpacklo_epi64( row[2], row[3] );
+	t3 = _mm_unpackhi_epi64( row[2], row[3] );
+	row[0] = t0;
+	row[1] = t1;
+	row[2] = t2;
+	row[3] = t3;
+	return;
+}
+
+__attribute__((target("sse2")))
+void	Tile4XRGBSSE2( Uint8 *dst, int pitch, const Uint8 *src, int step_x, int dir )
+{
+	__m128i	row[4];
+	int	i;
+	
+	Transpose4SSE2( src, step_x, dir, row );
+	for (i = 0; i < 4; i++)
+		_mm_storeu_si128( (__m128i*)(dst + i * pitch), ToXRGBSSE2( row[i] ) );
+	
+	return;
+}
+
+__attribute__((target("sse2")))
+void	Tile4XBGRSSE2( Uint8 *dst, int pitch, const Uint8 *src, int step_x, int dir )
+{
+	__m128i	row[4];
+	int	i;
+	
+	Transpose4SSE2( src, step_x, dir, row );
+	for (i = 0; i < 4; i++)
+		_mm_storeu_si128( (__m128i*)(dst + i * pitch), ToXBGRSSE2( row[i] ) );
+	
+	return;
+}
+
+__attribute__((target("sse2")))
+void	Tile4RGB565SSE2( Uint8 *dst, int pitch, const Uint8 *src, int step_x, int dir )
+{
+	__m128i	row[4], v;
+	int	i;
+	
+	Transpose4SSE2( src, step_x, dir, row );
+	for (i = 0; i < 4; i += 2)
+	{
+		v = _mm_packs_epi32( To565SSE2( row[i] ), To565SSE2( row[i+1] ) );
+		_mm_storel_epi64( (__m128i*)(dst + i * pitch), v );
+		_mm_storel_epi64( (__m128i*)(dst + (i + 1) * pitch), _mm_unpackhi_epi64( v, v ) );
+	}
+	
+	return;
+}
+
+__attribute__((target("avx2"))) inline static
+__m256i	Load8AVX2( const Uint8 *src, int dir )
+{
+	if (dir > 0)
+		return _mm256_loadu_si256( (const __m256i*)src );
+	
+	return _mm256_permutevar8x32_epi32( _mm256_loadu_si256( (const __m256i*)(src - 28) ),
+		_mm256_set_epi32( 0, 1, 2, 3, 4, 5, 6, 7 ) );
+}
+
+__attribute__((target("avx2")))
+void	RowXRGBAVX2( Uint8 *dst, const Uint8 *src, int n, int dir )
+{
+	const __m256i	mask = _mm256_set1_epi32( 0xFFFFFF );
+	int	i;
+	
+	for (i = 0; i + 8 <= n; i += 8, src += 32 * dir)
+		_mm256_storeu_si256( (__m256i*)(dst + i * 4), _mm256_and_si256( Load8AVX2( src, dir ), mask ) );
+	
+	RowXRGBSSE2( dst + i * 4, src, n - i, dir );
+	return;
+}
+
+__attribute__((target("avx2")))
+void	RowXBGRAVX2( Uint8 *dst, const Uint8 *src, int n, int dir )
+{
+	const __m256i	ff = _mm256_set1_epi32( 0xFF ), ff00 = _mm256_set1_epi32( 0xFF00 );
+	__m256i	v;
+	int	i;
+	
+	for (i = 0; i + 8 <= n; i += 8, src += 32 * dir)
+	{
+		v = Load8AVX2( src, dir );
+		v = _mm256_or_si256( _mm256_or_si256( _mm256_and_si256( _mm256_srli_epi32( v, 16 ), ff ),
+			_mm256_slli_epi32( _mm256_and_si256( v, ff ), 16 ) ), _mm256_and_si256( v, ff00 ) );
+		_mm256_storeu_si256( (__m256i*)(dst + i * 4), v );
+	}
+	
+	RowXBGRSSE2( dst + i * 4, src, n - i, dir );
+	return;
+}
+
+__attribute__((target("avx2"))) inline static
+__m256i	To565AVX2( __m256i v )
+{
+	v = _mm256_or_si256( _mm256_or_si256( _mm256_and_si256( _mm256_srli_epi32( v, 8 ), _mm256_set1_epi32( 0xF800 ) ),
+		_mm256_and_si256( _mm256_srli_epi32( v, 5 ), _mm256_set1_epi32( 0x07E0 ) ) ),
+		_mm256_and_si256( _mm256_srli_epi32( v, 3 ), _mm256_set1_epi32( 0x001F ) ) );
+	
+	return _mm256_srai_epi32( _mm256_slli_epi32( v, 16 ), 16 );
+}
+
+__attribute__((target("avx2")))
+void	RowRGB565AVX2( Uint8 *dst, const Uint8 *src, int n, int dir )
+{
+	__m256i	v;
+	int	i;
+	
+	for (i = 0; i + 16 <= n; i += 16, src += 64 * dir)
+	{
+		// the pack works per 128 bit lane, put the quarters back in order
+		v = _mm256_packs_epi32( To565AVX2( Load8AVX2( src, dir ) ), To565AVX2( Load8AVX2( src + 32 * dir, dir ) ) );
+		_mm256_storeu_si256( (__m256i*)(dst + i * 2), _mm256_permute4x64_epi64( v, 0xD8 ) );
+	}
+	
+	RowRGB565SSE2( dst + i * 2, src, n - i, dir );
+	return;
+}
+#endif
+
+#ifdef	BLIT_NEON
+inline static
+uint32x4_t	Load4NEON( const Uint8 *src, int dir )
+{
+	uint32x4_t	v;
+	
+	if (dir > 0)
+		return vld1q_u32( (const uint32_t*)src );
+	
+	v = vrev64q_u32( vld1q_u32( (const uint32_t*)(src - 12) ) );
+	return vcombine_u32( vget_high_u32( v ), vget_low_u32( v ) );
+}
+
+inline static
+uint32x4_t	ToXRGBNEON( uint32x4_t v )
+{
+	return vandq_u32( v, vdupq_n_u32( 0xFFFFFF ) );
+}
+
+inline static
+uint32x4_t	ToXBGRNEON( uint32x4_t v )
+{
+	const uint32x4_t	ff = vdupq_n_u32( 0xFF );
+	
+	return vorrq_u32( vorrq_u32( vandq_u32( vshrq_n_u32( v, 16 ), ff ),
+		vshlq_n_u32( vandq_u32( v, ff ), 16 ) ), vandq_u32( v, vdupq_n_u32( 0xFF00 ) ) );
+}
+
+inline static
+uint16x4_t	To565NEON( uint32x4_t v )
+{
+	return vmovn_u32( vorrq_u32( vorrq_u32( vandq_u32( vshrq_n_u32( v, 8 ), vdupq_n_u32( 0xF800 ) ),
+		vandq_u32( vshrq_n_u32( v, 5 ), vdupq_n_u32( 0x07E0 ) ) ),
+		vandq_u32( vshrq_n_u32( v, 3 ), vdupq_n_u32( 0x001F ) ) ) );
+}
+
+void	RowXRGBNEON( Uint8 *dst, const Uint8 *src, int n, int dir )
+{
+	int	i;
+	
+	for (i = 0; i + 4 <= n; i += 4, src += 16 * dir)
+		vst1q_u32( (uint32_t*)(dst + i * 4), ToXRGBNEON( Load4NEON( src, dir ) ) );
+	
+	RowXRGBScalar( dst + i * 4, src, n - i, dir );
+	return;
+}
+
+void	RowXBGRNEON( Uint8 *dst, const Uint8 *src, int n, int dir )
+{
+	int	i;
+	
+	for (i = 0; i + 4 <= n; i += 4, src += 16 * dir)
+		vst1q_u32( (uint32_t*)(dst + i * 4), ToXBGRNEON( Load4NEON( src, dir ) ) );
+	
+	RowXBGRScalar( dst + i * 4, src, n - i, dir );
+	return;
+}
+
+void	RowRGB565NEON( Uint8 *dst, const Uint8 *src, int n, int dir )
+{
+	int	i;
+	
+	for (i = 0; i + 4 <= n; i += 4, src += 16 * dir)
+		vst1_u16( (uint16_t*)(dst + i * 2), To565NEON( Load4NEON( src, dir ) ) );
+	
+	RowRGB565Scalar( dst + i * 2, src, n - i, dir );
+	return;
+}
+
+// loads four source columns and returns them as four display rows
+inline static
+void	Transpose4NEON( const Uint8 *src, int step_x, int dir, uint32x4_t *row )
+{
+	uint32x4x2_t	t01, t23;
+	
+	t01 = vtrnq_u32( Load4NEON( src, dir ), Load4NEON( src + step_x, dir ) );
+	t23 = vtrnq_u32( Load4NEON( src + 2 * step_x, dir ), Load4NEON( src + 3 * step_x, dir ) );
+	row[0] = vcombine_u32( vget_low_u32( t01.val[0] ), vget_low_u32( t23.val[0] ) );
+	row[1] = vcombine_u32( vget_low_u32( t01.val[1] ), vget_low_u32( t23.val[1] ) );
+	row[2] = vcombine_u32( vget_high_u32( t01.val[0] ), vget_high_u32( t23.val[0] ) );
+	row[3] = vcombine_u32( vget_high_u32( t01.val[1] ), vget_high_u32( t23.val[1] ) );
+	return;
+}
+
+void	Tile4XRGBNEON( Uint8 *dst, int pitch, const Uint8 *src, int step_x, int dir )
+{
+	uint32x4_t	row[4];
+	int	i;
+	
+	Transpose4NEON( src, step_x, dir, row );
+	for (i = 0; i < 4; i++)
+		vst1q_u32( (uint32_t*)(dst + i * pitch), ToXRGBNEON( row[i] ) );
+	
+	return;
+}
+
+void	Tile4XBGRNEON( Uint8 *dst, int pitch, const Uint8 *src, int step_x, int dir )
+{
+	uint32x4_t	row[4];
+	int	i;
+	
+	Transpose4NEON( src, step_x, dir, row );
+	for (i = 0; i < 4; i++)
+		vst1q_u32( (uint32_t*)(dst + i * pitch), ToXBGRNEON( row[i] ) );
+	
+	return;
+}
+
+void	Tile4RGB565NEON( Uint8 *dst, int pitch, const Uint8 *src, int step_x, int dir )
+{
+	uint32x4_t	row[4];
+	int	i;
+	
+	Transpose4NEON( src, step_x, dir, row );
+	for (i = 0; i < 4; i++)
+		vst1_u16( (uint16_t*)(dst + i * pitch), To565NEON( row[i] ) );
+	
+	return;
+}
+#endif
+
+
+RowFunc	row_func[] = {NULL, RowXRGBScalar, RowXBGRScalar, RowRGB565Scalar};
+Tile4Func	tile4_func[] = {NULL, NULL, NULL, NULL};
+
+
+// use the kernels of one instruction set: "scalar", "sse2", "avx2" or "neon";
+// false if the build or the CPU lacks it, the kernels are unchanged then
+bool	BlitSelect( const char *isa )
+{
+	if (!strcmp( isa, "scalar" ))
+	{
+		row_func[FORMAT_XRGB8888] = RowXRGBScalar;
+		row_func[FORMAT_XBGR8888] = RowXBGRScalar;
+		row_func[FORMAT_RGB565] = RowRGB565Scalar;
+		tile4_func[FORMAT_XRGB8888] = tile4_func[FORMAT_XBGR8888] = tile4_func[FORMAT_RGB565] = NULL;
+		return true;
+	}
+
+#if defined(BLIT_X86)
+	__builtin_cpu_init();
+	if (!strcmp( isa, "avx2" ) && __builtin_cpu_supports( "avx2" ))
+	{
+		row_func[FORMAT_XRGB8888] = RowXRGBAVX2;
+		row_func[FORMAT_XBGR8888] = RowXBGRAVX2;
+		row_func[FORMAT_RGB565] = RowRGB565AVX2;
+	}
+	else if (!strcmp( isa, "sse2" ) && __builtin_cpu_supports( "sse2" ))
+	{
+		row_func[FORMAT_XRGB8888] = RowXRGBSSE2;
+		row_func[FORMAT_XBGR8888] = RowXBGRSSE2;
+		row_func[FORMAT_RGB565] = RowRGB565SSE2;
+	}
+	else
+		return false;
+	
+	// rotated blocks have SSE2 kernels only, AVX2 implies SSE2
+	tile4_func[FORMAT_XRGB8888] = Tile4XRGBSSE2;
+	tile4_func[FORMAT_XBGR8888] = Tile4XBGRSSE2;
+	tile4_func[FORMAT_RGB565] = Tile4RGB565SSE2;
+	return true;
+#elif defined(BLIT_NEON)
+	if (strcmp( isa, "neon" ))
+		return false;
+	
+	row_func[FORMAT_XRGB8888] = RowXRGBNEON;
+	row_func[FORMAT_XBGR8888] = RowXBGRNEON;
+	row_func[FORMAT_RGB565] = RowRGB565NEON;
+	tile4_func[FORMAT_XRGB8888] = Tile4XRGBNEON;
+	tile4_func[FORMAT_XBGR8888] = Tile4XBGRNEON;
+	tile4_func[FORMAT_RGB565] = Tile4RGB565NEON;
+	return true;
+#else
+	return false;
+#endif
+}
+
+// pick the best conversion kernels for this CPU, call once at startup
+void	BlitInit( void )
+{
+	if (!BlitSelect( "avx2" ) && !BlitSelect( "sse2" ))
+		BlitSelect( "neon" );
+	
+	return;
+}
+
+BlitFormat	GetFormat( SDL_PixelFormat *fmt )
+{
+	if (fmt->BytesPerPixel == 4 && fmt->Gmask == 0x00FF00)
+	{
+		if (fmt->Rmask == 0xFF0000 && fmt->Bmask == 0x0000FF)
+			return FORMAT_XRGB8888;
+		else if (fmt->Rmask == 0x0000FF && fmt->Bmask == 0xFF0000)
+			return FORMAT_XBGR8888;
+	}
+	else if (fmt->BytesPerPixel == 2 && fmt->Rmask == 0xF800 && fmt->Gmask == 0x07E0 && fmt->Bmask == 0x001F)
+		return FORMAT_RGB565;
+	
+	return FORMAT_GENERIC;
+}
+
+bool	BlitClip( BlitInfo *blit, SDL_Rect *clip, BlitInfo *res )
+{
+	int	x1 = blit->rect.x > clip->x ? blit->rect.x : clip->x,
+		y1 = blit->rect.y > clip->y ? blit->rect.y : clip->y,
+		x2 = blit->rect.x + blit->rect.w < clip->x + clip->w ? blit->rect.x + blit->rect.w : clip->x + clip->w,
+		y2 = blit->rect.y + blit->rect.h < clip->y + clip->h ? blit->rect.y + blit->rect.h : clip->y + clip->h;
+	
+	if (x1 >= x2 || y1 >= y2)
+		return false;
+	
+	res->src = blit->src + (x1 - blit->rect.x) * blit->step_x + (y1 - blit->rect.y) * blit->step_y;
+	res->step_x = blit->step_x;
+	res->step_y = blit->step_y;
+	res->rect.x = x1;
+	res->rect.y = y1;
+	res->rect.w = x2 - x1;
+	res->rect.h = y2 - y1;
+	return true;
+}
+
+inline static
+void	PutPixel( Uint8 *dst, Uint8 bpp, Uint32 pixel )
+{
+	if (bpp == 4)
+		*(Uint32*)dst = pixel;
+	else if (bpp == 2)
+		*(Uint16*)dst = pixel;
+	else
+	{
+#if SDL_BYTEORDER == SDL_BIG_ENDIAN
+		dst[0] = pixel>>16;
+		dst[1] = pixel>>8;
+		dst[2] = pixel;
+#else
+		dst[0] = pixel;
+		dst[1] = pixel>>8;
+		dst[2] = pixel>>16;
+#endif
+	}
+	
+	return;
+}
+
+void	CopyGeneric( SDL_Surface *display, BlitInfo *blit )
+{
+	SDL_PixelFormat	*fmt = display->format;
+	Uint8	*src, *dst;
+	Uint32	pixel;
+	int	x, y;
+	
+	for (y = 0; y < blit->rect.h; y++)
+	{
+		src = blit->src + y * blit->step_y;
+		dst = (Uint8*)display->pixels + (blit->rect.y + y) * display->pitch
+			+ blit->rect.x * fmt->BytesPerPixel;
+		for (x = 0; x < blit->rect.w; x++)
+		{
+			pixel = *(Uint32*)src;
+			PutPixel( dst, fmt->BytesPerPixel, ((((pixel>>16)&0xFF)>>fmt->Rloss)<<fmt->Rshift)
+				| ((((pixel>>8)&0xFF)>>fmt->Gloss)<<fmt->Gshift)
+				| (((pixel&0xFF)>>fmt->Bloss)<<fmt->Bshift) );
+			
+			src += blit->step_x;
+			dst += fmt->BytesPerPixel;
+		}
+	}
+	
+	return;
+}
+
+void	HighlightGeneric( SDL_Surface *display, BlitInfo *blit, Green_RGBA *c )
+{
+	SDL_PixelFormat	*fmt = display->format;
+	unsigned short	ar = c->a * c->r, ag = c->a * c->g, ab = c->a * c->b, ia = 0xFF - c->a;
+	Uint8	*src, *dst;
+	Uint32	pixel;
+	int	x, y;
+	
+	for (y = 0; y < blit->rect.h; y++)
+	{
+		src = blit->src + y * blit->step_y;
+		dst = (Uint8*)display->pixels + (blit->rect.y + y) * display->pitch
+			+ blit->rect.x * fmt->BytesPerPixel;
+		for (x = 0; x < blit->rect.w; x++)
+		{
+			pixel = *(Uint32*)src;
+			PutPixel( dst, fmt->BytesPerPixel, ((((((pixel>>16)&0xFF) * ia + ar) / 256)>>fmt->Rloss)<<fmt->Rshift)
+				| ((((((pixel>>8)&0xFF) * ia + ag) / 256)>>fmt->Gloss)<<fmt->Gshift)
+				| (((((pixel&0xFF) * ia + ab) / 256)>>fmt->Bloss)<<fmt->Bshift) );
+			
+			src += blit->step_x;
+			dst += fmt->BytesPerPixel;
+		}
+	}
+	
+	return;
+}
+
+// copies a single block of a rotated blit, 4x4 at a time where a kernel exists
+void	BlockCopy( SDL_Surface *display, BlitInfo *blit, void *data )
+{
+	Tile4Func	tile4 = tile4_func[GetFormat( display->format )];
+	int	bpp = display->format->BytesPerPixel;
+	int	x, y, w4 = blit->rect.w & ~3, h4 = blit->rect.h & ~3;
+	BlitInfo	edge;
+	
+	if (!tile4)
+	{
+		CopyGeneric( display, blit );
+		return;
+	}
+	
+	for (y = 0; y < h4; y += 4)
+		for (x = 0; x < w4; x += 4)
+			tile4( (Uint8*)display->pixels + (blit->rect.y + y) * display->pitch + (blit->rect.x + x) * bpp,
+				display->pitch, blit->src + x * blit->step_x + y * blit->step_y,
+				blit->step_x, blit->step_y / 4 );
+	
+	// the right and bottom edges that do not fill a 4x4 block
+	edge = *blit;
+	edge.rect.x += w4;
+	edge.rect.w -= w4;
+	edge.src += w4 * blit->step_x;
+	CopyGeneric( display, &edge );
+	edge = *blit;
+	edge.rect.y += h4;
+	edge.rect.w = w4;
+	edge.rect.h -= h4;
+	edge.src += h4 * blit->step_y;
+	CopyGeneric( display, &edge );
+	return;
+}
+
+void	BlockHighlight( SDL_Surface *display, BlitInfo *blit, void *data )
+{
+	HighlightGeneric( display, blit, data );
+	return;
+}
+
+// walks a rotated blit in square blocks so the source rows touched by one
+// block stay in the cache while the display is written row by row
+void	BlitBlocked( SDL_Surface *display, BlitInfo *blit,
+	void (*func)( SDL_Surface *display, BlitInfo *block, void *data ), void *data )
+{
+	BlitInfo	block;
+	int	x, y;
+	
+	block.step_x = blit->step_x;
+	block.step_y = blit->step_y;
+	for (y = 0; y < blit->rect.h; y += BLIT_BLOCK)
+		for (x = 0; x < blit->rect.w; x += BLIT_BLOCK)
+		{
+			block.rect.x = blit->rect.x + x;
+			block.rect.y = blit->rect.y + y;
+			block.rect.w = blit->rect.w - x < BLIT_BLOCK ? blit->rect.w - x : BLIT_BLOCK;
+			block.rect.h = blit->rect.h - y < BLIT_BLOCK ? blit->rect.h - y : BLIT_BLOCK;
+			block.src = blit->src + x * blit->step_x + y * blit->step_y;
+			func( display, &block, data );
+		}
+	
+	return;
+}
+
+// true if neighbouring display rows are neighbouring pixels of one source row
+inline static
+bool	IsRotated( BlitInfo *blit )
+{
+	return blit->step_y == 4 || blit->step_y == -4;
+}
+
+void	BlitCopy( SDL_Surface *display, BlitInfo *blit )
+{
+	SDL_PixelFormat	*fmt = display->format;
+	RowFunc	row = row_func[GetFormat( fmt )];
+	int	y;
+	
+	if (IsRotated( blit ))
+	{
+		BlitBlocked( display, blit, BlockCopy, NULL );
+		return;
+	}
+	
+	if (row && (blit->step_x == 4 || blit->step_x == -4))
+	{
+		for (y = 0; y < blit->rect.h; y++)
+			row( (Uint8*)display->pixels + (blit->rect.y + y) * display->pitch
+				+ blit->rect.x * fmt->BytesPerPixel, blit->src + y * blit->step_y,
+				blit->rect.w, blit->step_x / 4 );
+		
+		return;
+	}
+	
+	CopyGeneric( display, blit );
+	return;
+}
+
+void	BlitHighlight( SDL_Surface *display, BlitInfo *blit, Green_RGBA *c )
+{
+	if (IsRotated( blit ))
+		BlitBlocked( display, blit, BlockHighlight, c );
+	else
+		HighlightGeneric( display, blit, c );
+	
+	return;
+}
+
+// move the content of rect by (dx, dy); the exposed part keeps its old pixels
+void	BlitScroll( SDL_Surface *display, SDL_Rect *rect, int dx, int dy )
+{
+	int	bpp = display->format->BytesPerPixel;
+	int	y, y1, y2, step, w = rect->w - abs( dx ), h = rect->h - abs( dy );
+	Uint8	*base = (Uint8*)display->pixels + rect->y * display->pitch + rect->x * bpp;
+	
+	if (w <= 0 || h <= 0)
+		return;
+	
+	// walk against the movement so no row is overwritten before it is read
+	y1 = dy > 0 ? h - 1 : 0;
+	y2 = dy > 0 ? -1 : h;
+	step = dy > 0 ? -1 : 1;
+	for (y = y1; y != y2; y += step)
+		memmove( base + (y + (dy > 0 ? dy : 0)) * display->pitch + (dx > 0 ? dx : 0) * bpp,
+			base + (y + (dy < 0 ? -dy : 0)) * display->pitch + (dx < 0 ? -dx : 0) * bpp, w * bpp );
+	
+	return;
+}
@@ -0,0 +1,44 @@
+/* green - the PDF reader
+ * Copyright (C) 2009 Florian Tobias Schandinat
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 3.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __BLIT_H__
+#define __BLIT_H__
+
+
+#include <stdbool.h>
+#include <SDL.h>
+#include "green.h"
+
+
+// a rectangle of the display together with the page pixels that go there
+typedef struct
+{
+	SDL_Rect	rect;
+	Uint8	*src;	// source pixel for the top left corner of rect
+	int	step_x, step_y;	// source byte offset between neighbouring display pixels
+	
+}	BlitInfo;
+
+
+void	BlitInit( void );
+bool	BlitSelect( const char *isa );
+bool	BlitClip( BlitInfo *blit, SDL_Rect *clip, BlitInfo *res );
+void	BlitCopy( SDL_Surface *display, BlitInfo *blit );
+void	BlitHighlight( SDL_Surface *display, BlitInfo *blit, Green_RGBA *c );
+void	BlitScroll( SDL_Surface *display, SDL_Rect *rect, int dx, int dy );
+
+
+#endif /* __BLIT_H__ */
@@ -0,0 +1,845 @@
+/* green - the PDF reader
+ * Copyright (C) 2009 Florian Tobias Schandinat
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 3.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "green.h"
+
+
+#define DISK_MAGIC	"green-p1"
+#define DISK_REPEAT	0x80000000u	// run flag of a repeated pixel
+#define DISK_QUEUE	32	// tiles waiting for the writer at most, more are not kept on disk
+
+
+// layout of a tile file: the header, then every row of pixels as runs; a run
+// is a count followed by one pixel repeated count times if DISK_REPEAT is set
+// in the count, else by count literal pixels
+typedef struct
+{
+	char	magic[8];
+	guint32	width, height, format, reserved;
+	
+}	DiskHeader;
+
+typedef struct
+{
+	char	*path;
+	off_t	size;
+	time_t	mtime;
+	
+}	DiskEntry;
+
+// a tile the writer stores
+typedef struct DiskJob
+{
+	char	*path;
+	cairo_surface_t	*surface;
+	struct DiskJob	*next;
+	
+}	DiskJob;
+
+
+// the memory limit of all caches together
+typedef struct
+{
+	Green_PageCache	**caches;
+	int	count;
+	size_t	size, limit;	// bytes in all caches, 0 if unlimited
+	Green_PageCache	*current;	// cache of the document on the screen
+	int	page;	// its current page, never evicted for the limit
+	unsigned long	clock;	// counts switches of current
+	
+}	CacheBudget;
+
+
+// all caches share one lock; the only writers are the UI and its render worker
+GMutex	cache_lock;
+CacheBudget	budget = {NULL, 0, 0, 0, NULL, -1, 0};
+
+
+void	CacheUnlink( Green_PageCache *cache, Green_PageBuffer *buf )
+{
+	if (buf->prev)
+		buf->prev->next = buf->next;
+	else
+		cache->first = buf->next;
+	
+	if (buf->next)
+		buf->next->prev = buf->prev;
+	else
+		cache->last = buf->prev;
+	
+	return;
+}
+
+void	CacheLinkFirst( Green_PageCache *cache, Green_PageBuffer *buf )
+{
+	buf->prev = NULL;
+	buf->next = cache->first;
+	if (cache->first)
+		cache->first->prev = buf;
+	else
+		cache->last = buf;
+	
+	cache->first = buf;
+	return;
+}
+
+void	CacheEvict( Green_PageCache *cache, Green_PageBuffer *buf )
+{
+	CacheUnlink( cache, buf );
+	cache->size -= buf->size;
+	budget.size -= buf->size;
+	cairo_surface_destroy( buf->surface );
+	free( buf );
+	return;
+}
+
+void	Green_CacheInit( Green_PageCache *cache, size_t limit )
+{
+	Green_PageCache	**tmp;
+	
+	cache->first = NULL;
+	cache->last = NULL;
+	cache->size = 0;
+	cache->limit = limit;
+	cache->hits = 0;
+	cache->misses = 0;
+	cache->disk = NULL;
+	cache->disk_dir = NULL;
+	cache->disk_tiles = NULL;
+	cache->used = 0;
+	
+	// a cache that cannot be registered is only bound by its own limit
+	g_mutex_lock( &cache_lock );
+	tmp = realloc( budget.caches, (budget.count + 1) * sizeof( *tmp ) );
+	if (tmp)
+	{
+		budget.caches = tmp;
+		budget.caches[budget.count++] = cache;
+	}
+	
+	g_mutex_unlock( &cache_lock );
+	return;
+}
+
+// empty the cache and take it off the budget, before it goes away
+void	Green_CacheRelease( Green_PageCache *cache )
+{
+	int	i;
+	
+	Green_CacheFlush( cache );
+	g_mutex_lock( &cache_lock );
+	for (i = 0; i < budget.count; i++)
+		if (budget.caches[i] == cache)
+			budget.caches[i] = budget.caches[--budget.count];
+	
+	if (budget.current == cache)
+		budget.current = NULL;
+	
+	if (cache->disk_tiles)
+		g_hash_table_destroy( cache->disk_tiles );
+	
+	cache->disk_tiles = NULL;
+	g_mutex_unlock( &cache_lock );
+	return;
+}
+
+// bytes all caches together may hold, 0 for no limit
+void	Green_CacheSetBudget( size_t limit )
+{
+	g_mutex_lock( &cache_lock );
+	budget.limit = limit;
+	g_mutex_unlock( &cache_lock );
+	return;
+}
+
+// the cache of the document on the screen, NULL if there is none
+void	Green_CacheSetCurrent( Green_PageCache *cache, int page )
+{
+	g_mutex_lock( &cache_lock );
+	if (cache != budget.current)
+	{
+		if (budget.current)
+			budget.current->used = ++budget.clock;
+		
+		budget.current = cache;
+	}
+	
+	budget.page = page;
+	g_mutex_unlock( &cache_lock );
+	return;
+}
+
+// evict for the memory limit: the tiles of the documents shown longest ago
+// first, then those of the current one but its current page; keep survives
+void	BudgetEnforce( Green_PageBuffer *keep )
+{
+	Green_PageCache	*victim;
+	Green_PageBuffer	*buf;
+	int	i;
+	
+	while (budget.limit && budget.size > budget.limit)
+	{
+		victim = NULL;
+		for (i = 0; i < budget.count; i++)
+			if (budget.caches[i] != budget.current && budget.caches[i]->last && budget.caches[i]->last != keep
+				&& (!victim || budget.caches[i]->used < victim->used))
+				victim = budget.caches[i];
+		
+		if (victim)
+		{
+			CacheEvict( victim, victim->last );
+			continue;
+		}
+		
+		for (buf = budget.current ? budget.current->last : NULL; buf && (buf == keep || buf->page == budget.page); buf = buf->prev);
+		if (!buf)
+			break;
+		
+		CacheEvict( budget.current, buf );
+	}
+	
+	return;
+}
+
+void	DiskName( char *name, size_t size, int page, double tscale, int tx, int ty )
+{
+	// tiles are rendered unrotated, so the rotation is no part of the name
+	snprintf( name, size, "%d-%a-%d-%d", page, tscale, tx, ty );
+	return;
+}
+
+char*	DiskPath( Green_PageCache *cache, int page, double tscale, int tx, int ty )
+{
+	char	name[64];
+	
+	DiskName( name, sizeof( name ), page, tscale, tx, ty );
+	return g_build_filename( cache->disk_dir, name, NULL );
+}
+
+// remember the tiles an earlier run left, once when the document is opened;
+// hidden files are still being written
+void	DiskScan( Green_PageCache *cache )
+{
+	GHashTable	*tiles = g_hash_table_new_full( g_str_hash, g_str_equal, free, NULL );
+	struct dirent	*de;
+	DIR	*dir;
+	char	*name;
+	
+	if ((dir = opendir( cache->disk_dir )))
+	{
+		while ((de = readdir( dir )))
+			if (de->d_name[0] != '.' && (name = strdup( de->d_name )))
+				g_hash_table_replace( tiles, name, name );
+		
+		closedir( dir );
+	}
+	
+	g_mutex_lock( &cache_lock );
+	cache->disk_tiles = tiles;
+	g_mutex_unlock( &cache_lock );
+	return;
+}
+
+// true if the tile may be on disk; a miss touches no file
+bool	DiskHas( Green_PageCache *cache, int page, double tscale, int tx, int ty )
+{
+	char	name[64];
+	bool	res;
+	
+	if (!cache->disk)
+		return false;
+	
+	DiskName( name, sizeof( name ), page, tscale, tx, ty );
+	g_mutex_lock( &cache_lock );
+	res = cache->disk_tiles && g_hash_table_lookup( cache->disk_tiles, name );
+	g_mutex_unlock( &cache_lock );
+	return res;
+}
+
+// note a tile as being on disk, or as gone if present is false
+void	DiskMark( Green_PageCache *cache, int page, double tscale, int tx, int ty, bool present )
+{
+	char	name[64], *key;
+	
+	DiskName( name, sizeof( name ), page, tscale, tx, ty );
+	g_mutex_lock( &cache_lock );
+	if (cache->disk_tiles && !present)
+		g_hash_table_remove( cache->disk_tiles, name );
+	else if (cache->disk_tiles && (key = strdup( name )))
+		g_hash_table_replace( cache->disk_tiles, key, key );
+	
+	g_mutex_unlock( &cache_lock );
+	return;
+}
+
+// keep the tiles of the document at uri in a directory of disk named after its
+// contents, so an edited file never picks up tiles of its former self
+void	Green_CacheOpenDisk( Green_PageCache *cache, Green_DiskCache *disk, const char *uri )
+{
+	struct stat	st;
+	guint64	hash;
+	char	*filename, *name;
+	int	fd;
+	
+	if (!disk->dir || !disk->limit || !(filename = g_filename_from_uri( uri, NULL, NULL )))
+		return;
+	
+	fd = open( filename, O_RDONLY );
+	g_free( filename );
+	if (fd < 0)
+		return;
+	
+	if (!fstat( fd, &st ) && Green_FileHash( fd, st.st_size, &hash ))
+	{
+		name = g_strdup_printf( "%016llx-%llx", (unsigned long long)hash, (unsigned long long)st.st_mtime );
+		cache->disk_dir = g_build_filename( disk->dir, name, NULL );
+		g_free( name );
+		if (!g_mkdir_with_parents( cache->disk_dir, 0700 ))
+			cache->disk = disk;
+	}
+	
+	close( fd );
+	if (cache->disk)
+		DiskScan( cache );
+	
+	return;
+}
+
+int	DiskEntryCompare( const void *a, const void *b )
+{
+	const DiskEntry	*ea = a, *eb = b;
+	
+	return ea->mtime < eb->mtime ? -1 : ea->mtime > eb->mtime;
+}
+
+// append the regular file at path to the list of count entries with room for
+// n, taking over path
+void	DiskListAdd( DiskEntry **list, int *count, int *n, size_t *size, char *path )
+{
+	DiskEntry	*tmp;
+	struct stat	st;
+	
+	if (stat( path, &st ) || !S_ISREG( st.st_mode ))
+	{
+		g_free( path );
+		return;
+	}
+	
+	if (*count == *n)
+	{
+		if (!(tmp = realloc( *list, (*n ? *n * 2 : 256) * sizeof( *tmp ) )))
+		{
+			g_free( path );
+			return;
+		}
+		
+		*list = tmp;
+		*n = *n ? *n * 2 : 256;
+	}
+	
+	(*list)[*count].path = path;
+	(*list)[*count].size = st.st_size;
+	(*list)[*count].mtime = st.st_mtime;
+	*size += st.st_size;
+	(*count)++;
+	return;
+}
+
+// returns the files of all documents below disk->dir, in it or in a directory
+// per document, and their size in total; hidden files are still being written
+DiskEntry*	DiskList( Green_DiskCache *disk, int *count, size_t *size )
+{
+	DiskEntry	*res = NULL;
+	DIR	*top, *sub;
+	struct dirent	*de, *fe;
+	char	*dir;
+	int	n = 0;
+	
+	*count = 0;
+	*size = 0;
+	if (!(top = opendir( disk->dir )))
+		return NULL;
+	
+	while ((de = readdir( top )))
+	{
+		if (de->d_name[0] == '.')
+			continue;
+		
+		dir = g_build_filename( disk->dir, de->d_name, NULL );
+		if (!(sub = opendir( dir )))
+		{
+			DiskListAdd( &res, count, &n, size, dir );
+			continue;
+		}
+		
+		while ((fe = readdir( sub )))
+			if (fe->d_name[0] != '.')
+				DiskListAdd( &res, count, &n, size, g_build_filename( dir, fe->d_name, NULL ) );
+		
+		closedir( sub );
+		g_free( dir );
+	}
+	
+	closedir( top );
+	return res;
+}
+
+// add bytes written to the size of the directory; once it exceeds the limit
+// the least recently used files of all documents go until 3/4 of it are left
+void	Green_DiskAccount( Green_DiskCache *disk, off_t bytes )
+{
+	DiskEntry	*list;
+	int	i, count;
+	
+	g_mutex_lock( &disk->lock );
+	disk->size += bytes;
+	if (disk->scanned && disk->size <= disk->limit)
+	{
+		g_mutex_unlock( &disk->lock );
+		return;
+	}
+	
+	list = DiskList( disk, &count, &disk->size );
+	disk->scanned = true;
+	if (disk->size > disk->limit)
+	{
+		qsort( list, count, sizeof( *list ), DiskEntryCompare );
+		for (i = 0; i < count && disk->size > disk->limit / 4 * 3; i++)
+			if (!unlink( list[i].path ))
+				disk->size -= list[i].size;
+	}
+	
+	for (i = 0; i < count; i++)
+		g_free( list[i].path );
+	
+	free( list );
+	g_mutex_unlock( &disk->lock );
+	return;
+}
+
+// compress a row of w pixels into runs, returns the number of words in dst
+size_t	DiskEncodeRow( const guint32 *src, int w, guint32 *dst )
+{
+	size_t	n = 0, count;
+	int	i = 0, j;
+	
+	while (i < w)
+	{
+		for (j = i + 1; j < w && src[j] == src[i]; j++);
+		if (j - i >= 3)
+		{
+			dst[n++] = DISK_REPEAT | (j - i);
+			dst[n++] = src[i];
+			i = j;
+			continue;
+		}
+		
+		// literal pixels up to the next three equal ones
+		count = n++;
+		for (j = i; j < w && !(j + 2 < w && src[j] == src[j+1] && src[j] == src[j+2]); j++)
+			dst[n++] = src[j];
+		
+		dst[count] = j - i;
+		i = j;
+	}
+	
+	return n;
+}
+
+// false if the runs do not describe exactly w x h pixels
+bool	DiskDecode( const guint32 *src, size_t words, unsigned char *dst, int stride, int w, int h )
+{
+	guint32	*row, count;
+	size_t	pos = 0;
+	int	x, y, i;
+	
+	for (y = 0; y < h; y++)
+	{
+		row = (guint32*)(dst + y * stride);
+		for (x = 0; x < w; x += count)
+		{
+			if (pos >= words)
+				return false;
+			
+			count = src[pos] & ~DISK_REPEAT;
+			if (!count || count > (guint32)(w - x))
+				return false;
+			
+			if (src[pos++] & DISK_REPEAT)
+			{
+				if (pos >= words)
+					return false;
+				
+				for (i = 0; i < (int)count; i++)
+					row[x+i] = src[pos];
+				
+				pos++;
+			}
+			else
+			{
+				if (words - pos < count)
+					return false;
+				
+				memcpy( row + x, src + pos, count * sizeof( *row ) );
+				pos += count;
+			}
+		}
+	}
+	
+	return pos == words;
+}
+
+// read a tile of an earlier run through mmap, NULL if there is none;
+// reading it marks the file as recently used
+cairo_surface_t*	DiskLoad( Green_PageCache *cache, int page, double tscale, int tx, int ty )
+{
+	cairo_surface_t	*surface = NULL;
+	DiskHeader	*header;
+	struct stat	st;
+	char	*path, *map;
+	bool	ok = false;
+	int	fd;
+	
+	path = DiskPath( cache, page, tscale, tx, ty );
+	fd = open( path, O_RDONLY );
+	
+	// a file too short for its header is as broken as one that does not decode
+	if (fd >= 0 && !fstat( fd, &st ) && (size_t)st.st_size < sizeof( *header ))
+	{
+		close( fd );
+		fd = -1;
+		unlink( path );
+	}
+	
+	if (fd < 0 || fstat( fd, &st ) || (map = mmap( NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0 )) == MAP_FAILED)
+	{
+		if (fd >= 0)
+			close( fd );
+		
+		// evicted by another document, broken, or the writer has not got to it yet
+		if (fd < 0)
+			DiskMark( cache, page, tscale, tx, ty, false );
+		
+		g_free( path );
+		return NULL;
+	}
+	
+	header = (DiskHeader*)map;
+	if (!memcmp( header->magic, DISK_MAGIC, 8 ) && (st.st_size - sizeof( *header )) % sizeof( guint32 ) == 0
+		&& (header->format == CAIRO_FORMAT_ARGB32 || header->format == CAIRO_FORMAT_RGB24)
+		&& header->width && header->width <= GREEN_TILE_SIZE && header->height && header->height <= GREEN_TILE_SIZE)
+	{
+		surface = cairo_image_surface_create( header->format, header->width, header->height );
+		cairo_surface_flush( surface );
+		ok = cairo_surface_status( surface ) == CAIRO_STATUS_SUCCESS
+			&& DiskDecode( (guint32*)(header + 1), (st.st_size - sizeof( *header )) / sizeof( guint32 ),
+				cairo_image_surface_get_data( surface ), cairo_image_surface_get_stride( surface ),
+				header->width, header->height );
+	}
+	
+	munmap( map, st.st_size );
+	if (ok)
+	{
+		cairo_surface_mark_dirty( surface );
+		futimens( fd, NULL );
+	}
+	else
+	{
+		if (surface)
+			cairo_surface_destroy( surface );
+		
+		surface = NULL;
+		unlink( path );
+		DiskMark( cache, page, tscale, tx, ty, false );
+	}
+	
+	close( fd );
+	g_free( path );
+	return surface;
+}
+
+// write to a temporary file first, so readers never see half a tile; it is
+// hidden, so neither scanning nor pruning the directory counts it; runs on
+// the writer thread
+void	DiskStore( Green_DiskCache *disk, char *path, cairo_surface_t *surface )
+{
+	DiskHeader	header;
+	unsigned char	*data;
+	guint32	*row;
+	size_t	n;
+	off_t	written;
+	char	*dir, *base, *tmp;
+	FILE	*file;
+	bool	ok;
+	int	y, w, h, stride;
+	
+	if (!access( path, F_OK ))
+		return;
+	
+	w = cairo_image_surface_get_width( surface );
+	h = cairo_image_surface_get_height( surface );
+	dir = g_path_get_dirname( path );
+	base = g_path_get_basename( path );
+	tmp = g_strdup_printf( "%s/.%s.%d", dir, base, (int)getpid() );
+	g_free( dir );
+	g_free( base );
+	row = malloc( 2 * w * sizeof( *row ) );
+	if (!row || !(file = fopen( tmp, "wb" )))
+	{
+		free( row );
+		g_free( tmp );
+		return;
+	}
+	
+	memset( &header, 0, sizeof( header ) );
+	memcpy( header.magic, DISK_MAGIC, 8 );
+	header.width = w;
+	header.height = h;
+	header.format = cairo_image_surface_get_format( surface );
+	ok = fwrite( &header, sizeof( header ), 1, file ) == 1;
+	written = sizeof( header );
+	cairo_surface_flush( surface );
+	data = cairo_image_surface_get_data( surface );
+	stride = cairo_image_surface_get_stride( surface );
+	for (y = 0; y < h && ok; y++)
+	{
+		n = DiskEncodeRow( (guint32*)(data + y * stride), w, row );
+		ok = fwrite( row, sizeof( *row ), n, file ) == n;
+		written += n * sizeof( *row );
+	}
+	
+	if (fclose( file ) || !ok || rename( tmp, path ))
+		unlink( tmp );
+	else
+		Green_DiskAccount( disk, written );
+	
+	free( row );
+	g_free( tmp );
+	return;
+}
+
+gpointer	DiskThread( gpointer data )
+{
+	Green_DiskCache	*disk = data;
+	DiskJob	*job;
+	
+	// what is queued is written before quitting, it is what the next run finds
+	g_mutex_lock( &disk->queue_lock );
+	while (disk->first || !disk->quit)
+	{
+		if (!(job = disk->first))
+		{
+			g_cond_wait( &disk->queue_cond, &disk->queue_lock );
+			continue;
+		}
+		
+		if (!(disk->first = job->next))
+			disk->last = NULL;
+		
+		disk->queued--;
+		g_mutex_unlock( &disk->queue_lock );
+		DiskStore( disk, job->path, job->surface );
+		cairo_surface_destroy( job->surface );
+		g_free( job->path );
+		free( job );
+		g_mutex_lock( &disk->queue_lock );
+	}
+	
+	g_mutex_unlock( &disk->queue_lock );
+	return NULL;
+}
+
+// hand a tile to the writer thread; if it lags behind, the tile is only not kept
+void	DiskQueue( Green_PageCache *cache, int page, double tscale, int tx, int ty, cairo_surface_t *surface )
+{
+	Green_DiskCache	*disk = cache->disk;
+	DiskJob	*job;
+	
+	g_mutex_lock( &disk->queue_lock );
+	if (!disk->thread && !disk->quit)
+		disk->thread = g_thread_try_new( "disk", DiskThread, disk, NULL );
+	
+	if (!disk->thread || disk->quit || disk->queued >= DISK_QUEUE || !(job = malloc( sizeof( *job ) )))
+	{
+		g_mutex_unlock( &disk->queue_lock );
+		return;
+	}
+	
+	job->path = DiskPath( cache, page, tscale, tx, ty );
+	job->surface = cairo_surface_reference( surface );
+	job->next = NULL;
+	if (disk->last)
+		disk->last->next = job;
+	else
+		disk->first = job;
+	
+	disk->last = job;
+	disk->queued++;
+	g_cond_signal( &disk->queue_cond );
+	g_mutex_unlock( &disk->queue_lock );
+	DiskMark( cache, page, tscale, tx, ty, true );
+	return;
+}
+
+void	Green_DiskInit( Green_DiskCache *disk )
+{
+	disk->dir = NULL;
+	disk->limit = 0;
+	disk->size = 0;
+	disk->scanned = false;
+	g_mutex_init( &disk->lock );
+	disk->thread = NULL;
+	g_mutex_init( &disk->queue_lock );
+	g_cond_init( &disk->queue_cond );
+	disk->first = disk->last = NULL;
+	disk->queued = 0;
+	disk->quit = false;
+	return;
+}
+
+// write the tiles still queued and stop the writer
+void	Green_DiskStop( Green_DiskCache *disk )
+{
+	g_mutex_lock( &disk->queue_lock );
+	disk->quit = true;
+	g_cond_signal( &disk->queue_cond );
+	g_mutex_unlock( &disk->queue_lock );
+	if (disk->thread)
+		g_thread_join( disk->thread );
+	
+	disk->thread = NULL;
+	return;
+}
+
+void	Green_CacheFlush( Green_PageCache *cache )
+{
+	g_mutex_lock( &cache_lock );
+	while (cache->first)
+		CacheEvict( cache, cache->first );
+	
+	g_mutex_unlock( &cache_lock );
+	return;
+}
+
+Green_PageBuffer*	CacheFind( Green_PageCache *cache, int page, double tscale, int tx, int ty )
+{
+	Green_PageBuffer	*buf;
+	
+	for (buf = cache->first; buf; buf = buf->next)
+		if (buf->page == page && buf->tscale == tscale && buf->tx == tx && buf->ty == ty)
+			break;
+	
+	return buf;
+}
+
+// takes over the reference to surface, returns false if the tile was cached already
+bool	CacheAdd( Green_PageCache *cache, int page, double tscale, int tx, int ty, cairo_surface_t *surface )
+{
+	Green_PageBuffer	*buf;
+	
+	g_mutex_lock( &cache_lock );
+	if (CacheFind( cache, page, tscale, tx, ty ) || !(buf = malloc( sizeof( *buf ) )))
+	{
+		g_mutex_unlock( &cache_lock );
+		cairo_surface_destroy( surface );
+		return false;
+	}
+	
+	buf->page = page;
+	buf->tscale = tscale;
+	buf->tx = tx;
+	buf->ty = ty;
+	buf->surface = surface;
+	buf->size = (size_t)cairo_image_surface_get_stride( surface )
+		* cairo_image_surface_get_height( surface );
+	CacheLinkFirst( cache, buf );
+	cache->size += buf->size;
+	budget.size += buf->size;
+	
+	// the new entry survives even if it alone exceeds the limit
+	while (cache->size > cache->limit && cache->last != buf)
+		CacheEvict( cache, cache->last );
+	
+	BudgetEnforce( buf );
+	g_mutex_unlock( &cache_lock );
+	return true;
+}
+
+// returns a new reference to the cached surface or NULL
+cairo_surface_t*	Green_CacheLookup( Green_PageCache *cache, int page, double tscale, int tx, int ty )
+{
+	Green_PageBuffer	*buf;
+	cairo_surface_t	*surface = NULL;
+	
+	g_mutex_lock( &cache_lock );
+	buf = CacheFind( cache, page, tscale, tx, ty );
+	if (buf)
+	{
+		if (buf != cache->first)
+		{
+			CacheUnlink( cache, buf );
+			CacheLinkFirst( cache, buf );
+		}
+		
+		surface = cairo_surface_reference( buf->surface );
+		cache->hits++;
+	}
+	else
+		cache->misses++;
+	
+	g_mutex_unlock( &cache_lock );
+	if (!surface && DiskHas( cache, page, tscale, tx, ty ) && (surface = DiskLoad( cache, page, tscale, tx, ty )))
+		CacheAdd( cache, page, tscale, tx, ty, cairo_surface_reference( surface ) );
+	
+	return surface;
+}
+
+// a tile kept on disk counts as well, it is loaded on the way
+bool	Green_CacheContains( Green_PageCache *cache, int page, double tscale, int tx, int ty )
+{
+	cairo_surface_t	*surface;
+	bool	res;
+	
+	g_mutex_lock( &cache_lock );
+	res = CacheFind( cache, page, tscale, tx, ty ) != NULL;
+	g_mutex_unlock( &cache_lock );
+	if (!res && DiskHas( cache, page, tscale, tx, ty ) && (surface = DiskLoad( cache, page, tscale, tx, ty )))
+	{
+		CacheAdd( cache, page, tscale, tx, ty, surface );
+		res = true;
+	}
+	
+	return res;
+}
+
+// takes over the reference to surface; a new tile is also queued for the disk
+void	Green_CacheInsert( Green_PageCache *cache, int page, double tscale, int tx, int ty, cairo_surface_t *surface )
+{
+	cairo_surface_reference( surface );
+	if (CacheAdd( cache, page, tscale, tx, ty, surface ) && cache->disk && !DiskHas( cache, page, tscale, tx, ty ))
+		DiskQueue( cache, page, tscale, tx, ty, surface );
+	
+	cairo_surface_destroy( surface );
+	return;
+}
@@ -0,0 +1,352 @@
+/* green - the PDF reader
+ * Copyright (C) 2009 Florian Tobias Schandinat
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 3.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <strings.h>
+#include <sys/stat.h>
+#include "green.h"
+
+
+#define EXPORT_MAX_SIZE	32767	// longest edge of an image surface cairo makes
+
+
+// one document being exported, shared by its workers
+typedef struct
+{
+	Green_Export	*ex;
+	Green_Document	*doc;
+	int	*pages, count;	// page indices to export
+	gint	next, failed;	// accessed atomically
+	char	*base;	// output path up to the page number
+	int	digits;	// of the page numbers in file names
+	int	width, height;	// area pages are fitted into
+	
+}	ExportJob;
+
+
+// page numbers from 1 in ranges like "1-3,7,10-", NULL meaning all pages;
+// returns the number of pages in *pages, -1 if str is malformed
+int	ExportRanges( const char *str, int page_count, int **pages )
+{
+	const char	*p = str ? str : "1-";
+	char	*end;
+	int	*res = NULL, *tmp, n = 0, from, to;
+	
+	while (*p)
+	{
+		from = *p == '-' ? 1 : strtol( p, &end, 10 );
+		if (*p != '-')
+		{
+			if (end == p)
+				break;
+			
+			p = end;
+		}
+		
+		to = from;
+		if (*p == '-')
+		{
+			p++;
+			to = *p >= '0' && *p <= '9' ? strtol( p, &end, 10 ) : page_count;
+			p = *p >= '0' && *p <= '9' ? end : p;
+		}
+		
+		if ((*p && *p != ',') || from < 1 || from > to || to > page_count
+			|| !(tmp = realloc( res, (n + to - from + 1) * sizeof( *res ) )))
+			break;
+		
+		res = tmp;
+		while (from <= to)
+			res[n++] = from++ - 1;
+		
+		if (*p)
+			p++;
+	}
+	
+	if (*p || !n)
+	{
+		free( res );
+		return -1;
+	}
+	
+	*pages = res;
+	return n;
+}
+
+// the page as shown with the rotation and mirroring of doc
+cairo_surface_t*	ExportTransform( Green_Document *doc, cairo_surface_t *src )
+{
+	cairo_surface_t	*dst;
+	guint32	*s, *d;
+	int	x, y, ux, uy, w, h, dir_x, dir_y, src_stride, dst_stride;
+	
+	w = cairo_image_surface_get_width( src );
+	h = cairo_image_surface_get_height( src );
+	if (doc->rotation % 2)
+	{
+		x = w;
+		w = h;
+		h = x;
+	}
+	
+	dst = cairo_image_surface_create( CAIRO_FORMAT_ARGB32, w, h );
+	if (cairo_surface_status( dst ) != CAIRO_STATUS_SUCCESS)
+		return dst;
+	
+	cairo_surface_flush( src );
+	s = (guint32*)cairo_image_surface_get_data( src );
+	d = (guint32*)cairo_image_surface_get_data( dst );
+	src_stride = cairo_image_surface_get_stride( src ) / 4;
+	dst_stride = cairo_image_surface_get_stride( dst ) / 4;
+	Green_GetDirection( doc, &dir_x, &dir_y );
+	for (y = 0; y < h; y++)
+		for (x = 0; x < w; x++)
+		{
+			ux = dir_x < 0 ? w - 1 - x : x;
+			uy = dir_y < 0 ? h - 1 - y : y;
+			d[y * dst_stride + x] = doc->rotation % 2 ? s[ux * src_stride + uy] : s[uy * src_stride + ux];
+		}
+	
+	cairo_surface_mark_dirty( dst );
+	return dst;
+}
+
+// binary PPM of an opaque surface, written row by row; returns the bytes written or -1
+gint64	ExportPPM( cairo_surface_t *surface, const char *path )
+{
+	unsigned char	*data, *row;
+	guint32	*src;
+	gint64	res;
+	FILE	*file;
+	bool	ok;
+	int	x, y, w, h, stride;
+	
+	w = cairo_image_surface_get_width( surface );
+	h = cairo_image_surface_get_height( surface );
+	if (!(row = malloc( w * 3 )))
+		return -1;
+	
+	if (!(file = fopen( path, "wb" )))
+	{
+		free( row );
+		return -1;
+	}
+	
+	cairo_surface_flush( surface );
+	data = cairo_image_surface_get_data( surface );
+	stride = cairo_image_surface_get_stride( surface );
+	res = fprintf( file, "P6\n%d %d\n255\n", w, h );
+	ok = res > 0;
+	for (y = 0; y < h && ok; y++)
+	{
+		src = (guint32*)(data + y * stride);
+		for (x = 0; x < w; x++)
+		{
+			row[x*3] = src[x] >> 16;
+			row[x*3+1] = src[x] >> 8;
+			row[x*3+2] = src[x];
+		}
+		
+		ok = fwrite( row, 3, w, file ) == (size_t)w;
+		res += w * 3;
+	}
+	
+	free( row );
+	if (fclose( file ) || !ok)
+		return -1;
+	
+	return res;
+}
+
+gint64	ExportPNG( cairo_surface_t *surface, const char *path )
+{
+	struct stat	st;
+	
+	if (cairo_surface_write_to_png( surface, path ) != CAIRO_STATUS_SUCCESS || stat( path, &st ))
+		return -1;
+	
+	return st.st_size;
+}
+
+// every worker renders with its own poppler document and writes a page
+// before taking the next, so memory does not grow with the page count
+gpointer	ExportThread( gpointer data )
+{
+	ExportJob	*job = data;
+	Green_Document	*doc = job->doc;
+	PopplerDocument	*pdoc;
+	PopplerPage	*page;
+	cairo_surface_t	*surface, *shown;
+	double	pwidth, pheight, tscale;
+	gint64	bytes;
+	char	*path;
+	int	i;
+	
+	if (!(pdoc = Green_AcquireDocument( doc )))
+	{
+		g_atomic_int_set( &job->failed, 1 );
+		return NULL;
+	}
+	
+	while ((i = g_atomic_int_add( &job->next, 1 )) < job->count)
+	{
+		page = poppler_document_get_page( pdoc, job->pages[i] );
+		poppler_page_get_size( page, &pwidth, &pheight );
+		tscale = Green_FitSize( doc, pwidth, pheight, job->width, job->height ) * doc->finescale;
+		
+		// cairo turns a surface it cannot make into an error surface without pixels
+		if (pwidth * tscale > EXPORT_MAX_SIZE || pheight * tscale > EXPORT_MAX_SIZE)
+			surface = NULL;
+		else
+			surface = Green_RenderRegion( page, tscale, 0, 0,
+				pwidth * tscale >= 1 ? pwidth * tscale : 1, pheight * tscale >= 1 ? pheight * tscale : 1 );
+		
+		g_object_unref( G_OBJECT( page ) );
+		if (surface && cairo_surface_status( surface ) == CAIRO_STATUS_SUCCESS && (doc->rotation || doc->mirrored))
+		{
+			shown = ExportTransform( doc, surface );
+			cairo_surface_destroy( surface );
+			surface = shown;
+		}
+		
+		if (!surface || cairo_surface_status( surface ) != CAIRO_STATUS_SUCCESS)
+		{
+			fprintf( stderr, "Failed to render page %d at %.0fx%.0f\n", job->pages[i] + 1, pwidth * tscale, pheight * tscale );
+			g_atomic_int_set( &job->failed, 1 );
+			if (surface)
+				cairo_surface_destroy( surface );
+			
+			continue;
+		}
+		
+		path = g_strdup_printf( "%s%0*d.%s", job->base, job->digits, job->pages[i] + 1, job->ex->ppm ? "ppm" : "png" );
+		bytes = job->ex->ppm ? ExportPPM( surface, path ) : ExportPNG( surface, path );
+		cairo_surface_destroy( surface );
+		if (bytes < 0)
+		{
+			fprintf( stderr, "Failed to write: %s\n", path );
+			g_atomic_int_set( &job->failed, 1 );
+		}
+		else
+		{
+			g_mutex_lock( &job->ex->lock );
+			job->ex->exported++;
+			job->ex->bytes += bytes;
+			g_mutex_unlock( &job->ex->lock );
+		}
+		
+		g_free( path );
+	}
+	
+	Green_ReleaseDocument( doc, pdoc );
+	return NULL;
+}
+
+void	Green_ExportInit( Green_Export *ex )
+{
+	ex->dir = NULL;
+	ex->pages = NULL;
+	ex->scale = 1;
+	ex->rotation = 0;
+	ex->mirrored = false;
+	ex->ppm = false;
+	g_mutex_init( &ex->lock );
+	ex->exported = 0;
+	ex->bytes = 0;
+	ex->start = g_get_monotonic_time();
+	return;
+}
+
+// render the pages of the document at name into ex->dir on all processors;
+// the files are named after the document and the page number
+int	Green_ExportDocument( Green_RTD *rtd, Green_Export *ex, char *name )
+{
+	Green_Document	*doc;
+	ExportJob	job;
+	GThread	**threads;
+	char	*stem, *dot;
+	int	id, i, n = g_get_num_processors(), count = 0;
+	
+	if ((id = Green_Open( rtd, name )) < 0)
+	{
+		fprintf( stderr, "Failed to open: %s\n", name );
+		return -1;
+	}
+	
+	doc = rtd->docs[id];
+	doc->rotation = ex->rotation;
+	doc->mirrored = ex->mirrored;
+	doc->finescale = ex->scale;
+	if ((job.count = ExportRanges( ex->pages, doc->page_count, &job.pages )) < 0)
+	{
+		fprintf( stderr, "Invalid pages for: %s\n", name );
+		Green_Close( rtd, id );
+		return -1;
+	}
+	
+	stem = strdup( !strcmp( name, "-" ) ? "stdin" : strrchr( name, '/' ) ? strrchr( name, '/' ) + 1 : name );
+	if (stem && (dot = strrchr( stem, '.' )) && !strcasecmp( dot, ".pdf" ))
+		*dot = 0;
+	
+	job.ex = ex;
+	job.doc = doc;
+	job.next = 0;
+	job.failed = !stem;
+	if (g_mkdir_with_parents( ex->dir, 0755 ))
+	{
+		fprintf( stderr, "Failed to create: %s\n", ex->dir );
+		job.failed = true;
+	}
+	
+	job.base = stem ? g_strdup_printf( "%s/%s-", ex->dir, stem ) : NULL;
+	job.width = rtd->width;
+	job.height = rtd->height;
+	for (job.digits = 1, i = doc->page_count; i >= 10; i /= 10)
+		job.digits++;
+	
+	n = n < 1 ? 1 : n > job.count ? job.count : n;
+	threads = job.failed ? NULL : malloc( n * sizeof( *threads ) );
+	for (i = 0; threads && i < n; i++)
+		if ((threads[count] = g_thread_try_new( "export", ExportThread, &job, NULL )))
+			count++;
+	
+	if (!job.failed && !count)
+		ExportThread( &job );
+	
+	for (i = 0; i < count; i++)
+		g_thread_join( threads[i] );
+	
+	free( threads );
+	free( job.pages );
+	free( stem );
+	g_free( job.base );
+	Green_Close( rtd, id );
+	return job.failed ? -1 : 0;
+}
+
+void	Green_ExportSummary( Green_Export *ex )
+{
+	double	secs = (g_get_monotonic_time() - ex->start) / 1e6;
+	
+	if (secs <= 0)
+		secs = 1e-6;
+	
+	printf( "%d pages, %.1f MB in %.2f s: %.1f pages/s, %.1f MB/s\n", ex->exported,
+		ex->bytes / 1e6, secs, ex->exported / secs, ex->bytes / 1e6 / secs );
+	return;
+}
@@ -18,9 +18,45 @@
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/inotify.h>
 #include "green.h"
 
 
+#define GEOMETRY_CHUNK	256	// pages whose sizes are looked up at once
+#define LOADER_THREADS	8	// upper limit of workers opening documents
+#define MAP_TAIL	(64 << 10)	// bytes at the end of a mapped file that are read ahead
+#define READ_CHUNK	(1 << 20)	// first buffer size for a document read from a pipe
+#define RELOAD_SETTLE	300000	// microseconds a file has to rest before it is reloaded
+#define RELOAD_NEAR	3	// pages before and after the current one matched before the swap
+
+#define RELOAD_OPENING	0
+#define RELOAD_NEARBY	1	// the fingerprints around the current page are taken
+#define RELOAD_FINISHED	2	// all fingerprints are taken, or the document failed to open
+
+
+// a document being reopened, shared by its worker and the UI
+typedef struct ReloadJob
+{
+	Green_RTD	*rtd;
+	Green_Document	*old, *doc;	// the version replaced and the new one, NULL if it failed
+	int	page;	// current page of old when the reload started
+	guint64	*old_prints, *new_prints;	// per page, 0 if not taken
+	Green_PageText	*texts;	// per new page, extracted for its fingerprint and handed on to its index
+	int	text_count;	// entries of texts
+	int	*map;	// new page of every old one, -1 if not matched yet; NULL if nothing is matched
+	bool	*taken;	// per new page, is an old page matched to it?
+	char	*hits_str;	// search string the hits moved over belong to
+	gint	stage, quit;	// accessed atomically
+	bool	swapped;	// doc is in the slot of old, which waits for the rest to be matched
+	
+}	ReloadJob;
+
+
 char*	FilenameToURI( char *filename )
 {
 	const char	*prefix = "file:";
@@ -29,151 +65,1197 @@ char*	FilenameToURI( char *filename )
 		*uri = malloc( strlen( prefix ) + strlen( filename ) + 1
 			+ (abs ? 0 : strlen( wd ) + 1) );
 	
-	if (!uri || !(abs || wd))
+	if (!uri || !(abs || wd))
+	{
+		free( uri );
+		free( wd );
+		return NULL;
+	}
+	
+	if (abs)
+		sprintf( uri, "%s%s", prefix, filename ); 
+	else
+	{
+		sprintf( uri, "%s%s/%s", prefix, wd, filename );
+		free( wd );
+	}
+	
+	return uri;
+}
+
+void	GeometryFree( Green_Geometry *geo )
+{
+	free( geo->width );
+	free( geo->height );
+	free( geo->sum_width );
+	free( geo->sum_height );
+	geo->width = geo->height = geo->sum_width = geo->sum_height = NULL;
+	geo->known = 0;
+	return;
+}
+
+// fill in the sizes up to the end of the chunk containing page_nr; false if out of memory
+bool	GeometryFill( Green_Document *doc, int page_nr )
+{
+	Green_Geometry	*geo = &doc->geometry;
+	PopplerPage	*page;
+	int	i, end;
+	
+	if (page_nr < geo->known)
+		return true;
+	
+	if (!geo->width)
+	{
+		geo->width = malloc( doc->page_count * sizeof( *geo->width ) );
+		geo->height = malloc( doc->page_count * sizeof( *geo->height ) );
+		geo->sum_width = malloc( (doc->page_count + 1) * sizeof( *geo->sum_width ) );
+		geo->sum_height = malloc( (doc->page_count + 1) * sizeof( *geo->sum_height ) );
+		if (!geo->width || !geo->height || !geo->sum_width || !geo->sum_height)
+		{
+			GeometryFree( geo );
+			return false;
+		}
+		
+		geo->sum_width[0] = geo->sum_height[0] = 0;
+		geo->max_width = geo->max_height = 0;
+	}
+	
+	end = (page_nr / GEOMETRY_CHUNK + 1) * GEOMETRY_CHUNK;
+	if (end > doc->page_count)
+		end = doc->page_count;
+	
+	for (i = geo->known; i < end; i++)
+	{
+		page = poppler_document_get_page( doc->doc, i );
+		poppler_page_get_size( page, &geo->width[i], &geo->height[i] );
+		g_object_unref( G_OBJECT( page ) );
+		geo->sum_width[i+1] = geo->sum_width[i] + geo->width[i];
+		geo->sum_height[i+1] = geo->sum_height[i] + geo->height[i];
+		geo->max_width = geo->width[i] > geo->max_width ? geo->width[i] : geo->max_width;
+		geo->max_height = geo->height[i] > geo->max_height ? geo->height[i] : geo->max_height;
+	}
+	
+	geo->known = end;
+	return true;
+}
+
+// size of a page in points, unrotated
+void	Green_GetPageSize( Green_Document *doc, int page_nr, double *width, double *height )
+{
+	PopplerPage	*page;
+	
+	if (GeometryFill( doc, page_nr ))
+	{
+		*width = doc->geometry.width[page_nr];
+		*height = doc->geometry.height[page_nr];
+		return;
+	}
+	
+	page = poppler_document_get_page( doc->doc, page_nr );
+	poppler_page_get_size( page, width, height );
+	g_object_unref( G_OBJECT( page ) );
+	return;
+}
+
+// extent in points of all pages before page_nr when stacked along the page
+// height, or along the width if rotated
+double	Green_GetPageStart( Green_Document *doc, int page_nr, bool rotated )
+{
+	double	width, height, res = 0;
+	int	i;
+	
+	if (GeometryFill( doc, page_nr ))
+		return rotated ? doc->geometry.sum_width[page_nr] : doc->geometry.sum_height[page_nr];
+	
+	for (i = 0; i < page_nr; i++)
+	{
+		Green_GetPageSize( doc, i, &width, &height );
+		res += rotated ? width : height;
+	}
+	
+	return res;
+}
+
+void	Green_GetScrollRegion( Green_Document *doc, int w, int h, int *scroll_w, int *scroll_h )
+{
+	Green_GetPageDimension( doc, doc->page_cur, scroll_w, scroll_h, Green_Fit( doc, w, h ) * doc->finescale, doc->rotation % 2 );
+	if (*scroll_w < w)
+		*scroll_w = 0;
+	else	
+		*scroll_w -= w;
+	
+	if (*scroll_h < h)
+		*scroll_h = 0;
+	else	
+		*scroll_h -= h;
+	
+	return;
+}
+
+// true if the file of st may be rewritten in place by this user
+bool	DocumentWritable( struct stat *st )
+{
+	if (st->st_uid == geteuid())
+		return st->st_mode & S_IWUSR;
+	
+	if (st->st_gid == getegid())
+		return st->st_mode & S_IWGRP;
+	
+	return st->st_mode & S_IWOTH;
+}
+
+// map a regular file for poppler to read in place instead of through its own
+// buffers; poppler starts at the cross reference table at the end and jumps
+// around from there, so only the end is read ahead; files the user may write
+// are not mapped, a build truncating one in place would make any access to
+// the mapping beyond its new end raise SIGBUS
+bool	DocumentMapFile( int fd, char **data, size_t *size )
+{
+	struct stat	st;
+	size_t	tail;
+	char	*map;
+	
+	if (fstat( fd, &st ) || !S_ISREG( st.st_mode ) || !st.st_size || st.st_size > INT_MAX || DocumentWritable( &st ))
+		return false;
+	
+	map = mmap( NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0 );
+	if (map == MAP_FAILED)
+		return false;
+	
+	tail = st.st_size > MAP_TAIL ? (st.st_size - MAP_TAIL) & ~(size_t)(sysconf( _SC_PAGESIZE ) - 1) : 0;
+	madvise( map, st.st_size, MADV_RANDOM );
+	madvise( map + tail, st.st_size - tail, MADV_WILLNEED );
+	*data = map;
+	*size = st.st_size;
+	return true;
+}
+
+// everything left to read from fd into allocated memory
+bool	DocumentReadAll( int fd, char **data, size_t *size )
+{
+	struct stat	st;
+	char	*buf = NULL, *tmp;
+	size_t	len = 0, alloc = 0;
+	ssize_t	n;
+	
+	// one more byte than a regular file has, to see its end in one go
+	if (!fstat( fd, &st ) && S_ISREG( st.st_mode ) && st.st_size > 0 && st.st_size < INT_MAX)
+		alloc = st.st_size + 1;
+	
+	if (alloc && !(buf = malloc( alloc )))
+		return false;
+	
+	do
+	{
+		if (len == alloc)
+		{
+			alloc = alloc ? alloc * 2 : READ_CHUNK;
+			if (alloc > INT_MAX || !(tmp = realloc( buf, alloc )))
+			{
+				free( buf );
+				return false;
+			}
+			
+			buf = tmp;
+		}
+		
+		n = read( fd, buf + len, alloc - len );
+		if (n > 0)
+			len += n;
+	}
+	while (n > 0 || (n < 0 && errno == EINTR));
+	
+	if (n < 0 || !len)
+	{
+		free( buf );
+		return false;
+	}
+	
+	*data = buf;
+	*size = len;
+	return true;
+}
+
+// all of stdin, mapped if it is a regular file that cannot change
+bool	DocumentReadStdin( char **data, size_t *size, bool *mapped )
+{
+	if ((*mapped = DocumentMapFile( STDIN_FILENO, data, size )))
+		return true;
+	
+	return DocumentReadAll( STDIN_FILENO, data, size );
+}
+
+// the bytes of the document at uri if it is "-" for stdin or a local file;
+// false if poppler has to open it by uri; a file is mapped unless it is
+// watched or may be rewritten in place, else it is read into memory
+bool	DocumentLoad( const char *uri, bool watched, char **data, size_t *size, bool *mapped )
+{
+	char	*filename;
+	bool	res;
+	int	fd;
+	
+	if (!strcmp( uri, "-" ))
+		return DocumentReadStdin( data, size, mapped );
+	
+	if (!(filename = g_filename_from_uri( uri, NULL, NULL )))
+		return false;
+	
+	fd = open( filename, O_RDONLY );
+	g_free( filename );
+	if (fd < 0)
+		return false;
+	
+	*mapped = !watched && DocumentMapFile( fd, data, size );
+	res = *mapped || DocumentReadAll( fd, data, size );
+	close( fd );
+	return res;
+}
+
+void	DocumentFreeData( Green_Document *doc )
+{
+	if (doc->mapped)
+		munmap( doc->data, doc->data_size );
+	else
+		free( doc->data );
+	
+	return;
+}
+
+// watch the directory of the file of doc, files are often replaced rather
+// than rewritten; runs on any thread like DocumentOpen
+void	ReloadInit( Green_RTD *rtd, Green_Document *doc )
+{
+	Green_Reload	*rl = &doc->reload;
+	char	*filename, *slash;
+	
+	rl->thread = NULL;
+	rl->job = NULL;
+	rl->changed = 0;
+	rl->watch = -1;
+	rl->name = NULL;
+	if (rtd->watch_fd < 0 || !(filename = g_filename_from_uri( doc->uri, NULL, NULL )))
+		return;
+	
+	if ((slash = strrchr( filename, '/' )) && (rl->name = strdup( slash + 1 )))
+	{
+		*slash = 0;
+		rl->watch = inotify_add_watch( rtd->watch_fd, *filename ? filename : "/", IN_CLOSE_WRITE | IN_MOVED_TO );
+	}
+	
+	g_free( filename );
+	return;
+}
+
+// opens the document at uri, or from the data of size bytes if given, without
+// giving it a slot in rtd->docs; takes over uri and data, data being released
+// with munmap if mapped and with free otherwise; without index its text index
+// waits for Green_IndexBuild; only reads the defaults from rtd, so it may run
+// on any thread
+Green_Document*	DocumentOpen( Green_RTD *rtd, char *uri, char *data, size_t size, bool mapped, bool index )
+{
+	Green_Document	*doc = malloc( sizeof( *doc ) );
+	
+	if (!doc)
+	{
+		free( uri );
+		if (mapped)
+			munmap( data, size );
+		else
+			free( data );
+		
+		return NULL;
+	}
+	
+	doc->uri = uri;
+	doc->data = data;
+	doc->data_size = size;
+	doc->mapped = mapped;
+	if (!doc->data)
+		DocumentLoad( doc->uri, rtd->watch_fd >= 0, &doc->data, &doc->data_size, &doc->mapped );
+	
+	if (doc->data)
+		doc->doc = poppler_document_new_from_data( doc->data, doc->data_size, NULL, NULL );
+	else if (strcmp( doc->uri, "-" ))
+		doc->doc = poppler_document_new_from_file( doc->uri, NULL, NULL );
+	else
+		doc->doc = NULL;
+	
+	if (!doc->doc)
+	{
+		DocumentFreeData( doc );
+		free( doc->uri );
+		free( doc );
+		return NULL;
+	}
+	
+	doc->page_count = poppler_document_get_n_pages( doc->doc );
+	doc->page_cur = 0;
+	doc->xoffset = 0;
+	doc->yoffset = 0;
+	doc->mirrored = false;
+	doc->rotation = 0;
+	doc->fit_method = rtd->fit_method;
+	doc->finescale = 1;
+	doc->continuous = rtd->flags & GREEN_CONTINUOUS;
+	doc->gap = rtd->gap;
+	doc->search_str = NULL;
+	doc->hits_str = NULL;
+	doc->hits = NULL;
+	doc->geometry.width = doc->geometry.height = NULL;
+	doc->geometry.sum_width = doc->geometry.sum_height = NULL;
+	doc->geometry.max_width = doc->geometry.max_height = 0;
+	doc->geometry.known = 0;
+	doc->bb = rtd->bb;
+	Green_CacheInit( &doc->cache, rtd->cache_limit );
+	Green_CacheOpenDisk( &doc->cache, &rtd->disk, doc->uri );
+	g_mutex_init( &doc->lock );
+	doc->pool = NULL;
+	doc->pool_count = 0;
+	Green_IndexStart( doc, &rtd->text, index && !(rtd->flags & GREEN_HEADLESS) );
+	Green_ThumbsInit( doc );
+	ReloadInit( rtd, doc );
+	return doc;
+}
+
+void	ReloadJobFree( ReloadJob *job )
+{
+	int	i;
+	
+	for (i = 0; job->texts && i < job->text_count; i++)
+	{
+		free( job->texts[i].text );
+		free( job->texts[i].boxes );
+	}
+	
+	free( job->texts );
+	free( job->old_prints );
+	free( job->new_prints );
+	free( job->map );
+	free( job->taken );
+	free( job->hits_str );
+	free( job );
+	return;
+}
+
+void	DocumentFree( Green_Document *doc )
+{
+	ReloadJob	*job;
+	int	i;
+	
+	// a reload still running is stopped, the version it has not put in place is dropped
+	if ((job = doc->reload.job))
+	{
+		g_atomic_int_set( &job->quit, 1 );
+		g_thread_join( doc->reload.thread );
+		if (job->swapped ? job->old : job->doc)
+			DocumentFree( job->swapped ? job->old : job->doc );
+		
+		ReloadJobFree( job );
+	}
+	
+	free( doc->reload.name );
+	Green_IndexStop( doc );
+	Green_ThumbsStop( doc );
+	for (i = 0; i < doc->pool_count; i++)
+		g_object_unref( G_OBJECT( doc->pool[i] ) );
+	
+	free( doc->pool );
+	g_mutex_clear( &doc->lock );
+	g_object_unref( G_OBJECT( doc->doc ) );
+	DocumentFreeData( doc );
+	Green_CacheRelease( &doc->cache );
+	g_free( doc->cache.disk_dir );
+	Green_ClearHits( doc );
+	GeometryFree( &doc->geometry );
+	free( doc->search_str );
+	free( doc->uri );
+	free( doc );
+	return;
+}
+
+// "-" stays as it is for stdin
+char*	DocumentURI( char *name )
+{
+	return strncmp( name, "file:", 5 ) && strcmp( name, "-" ) ? FilenameToURI( name ) : strdup( name );
+}
+
+// returns the slot doc was put in, -1 if there is no memory
+int	DocumentSlot( Green_RTD *rtd, Green_Document *doc )
+{
+	Green_Document	**tmp;
+	int	i;
+	
+	for (i = 0; i < rtd->doc_count; i++)
+	{
+		if (rtd->docs[i])
+			continue;
+		
+		rtd->docs[i] = doc;
+		return i;
+	}
+	
+	i = rtd->doc_count;
+	tmp = realloc( rtd->docs, (rtd->doc_count + 1) * sizeof( *tmp ) );
+	if (!tmp)
+		return -1;
+	
+	tmp[i] = doc;
+	rtd->docs = tmp;
+	rtd->doc_count++;
+	return i;
+}
+
+int	Green_Open( Green_RTD *rtd, char *uri )
+{
+	Green_Document	*doc;
+	char	*full;
+	int	i;
+	
+	if (!(full = DocumentURI( uri )))
+		return -1;
+	
+	if (!(doc = DocumentOpen( rtd, full, NULL, 0, false, true )))
+		return -2;
+	
+	if ((i = DocumentSlot( rtd, doc )) < 0)
+		DocumentFree( doc );
+	
+	return i;
+}
+
+// open a document from a buffer, see DocumentOpen for data and mapped
+int	Green_OpenData( Green_RTD *rtd, char *data, size_t size, bool mapped )
+{
+	Green_Document	*doc;
+	char	*uri = strdup( "-" );
+	int	i;
+	
+	if (!uri || size > INT_MAX)
+	{
+		free( uri );
+		if (mapped)
+			munmap( data, size );
+		else
+			free( data );
+		
+		return -1;
+	}
+	
+	if (!(doc = DocumentOpen( rtd, uri, data, size, mapped, true )))
+		return -2;
+	
+	if ((i = DocumentSlot( rtd, doc )) < 0)
+		DocumentFree( doc );
+	
+	return i;
+}
+
+void	Green_Close( Green_RTD *rtd, int id )
+{
+	Green_Document	*doc;
+	bool	shared = false;
+	int	n;
+	
+	// a document still being opened cannot be closed
+	if (!Green_IsDocValid( rtd, id ))
+		return;
+	
+	doc = rtd->docs[id];
+	Green_PrefetchCancel( &rtd->prefetch, doc );
+	Green_SearchCancel( &rtd->search, doc );
+	
+	// files in one directory share its watch, and one still being opened may
+	// have been given it already
+	for (n = 0; n < rtd->doc_count && doc->reload.watch >= 0; n++)
+		if (n != id && rtd->docs[n] && (!Green_IsDocValid( rtd, n ) || rtd->docs[n]->reload.watch == doc->reload.watch))
+			shared = true;
+	
+	if (doc->reload.watch >= 0 && !shared)
+		inotify_rm_watch( rtd->watch_fd, doc->reload.watch );
+	
+	DocumentFree( doc );
+	rtd->docs[id] = NULL;
+	if (id < rtd->doc_count - 1)
+		return;
+	
+	for (n = id; n > 0 && !rtd->docs[n-1]; n-- );
+	rtd->doc_count = n;
+	rtd->docs = realloc( rtd->docs, n * sizeof( *rtd->docs ) );
+	return;
+}
+
+gpointer	LoaderThread( gpointer data )
+{
+	Green_RTD	*rtd = data;
+	Green_Loader	*ld = &rtd->loader;
+	Green_Document	*doc;
+	char	*uri;
+	int	i;
+	
+	g_mutex_lock( &ld->lock );
+	while (!ld->quit && ld->next < ld->job_count)
+	{
+		i = ld->next++;
+		uri = strdup( ld->jobs[i].placeholder->uri );
+		g_mutex_unlock( &ld->lock );
+		doc = uri ? DocumentOpen( rtd, uri, NULL, 0, false, true ) : NULL;
+		g_mutex_lock( &ld->lock );
+		ld->jobs[i].doc = doc;
+		ld->jobs[i].opened = true;
+		if (ld->done)
+			ld->done();
+	}
+	
+	g_mutex_unlock( &ld->lock );
+	return NULL;
+}
+
+void	Green_LoaderInit( Green_Loader *ld )
+{
+	g_mutex_init( &ld->lock );
+	ld->threads = NULL;
+	ld->thread_count = 0;
+	ld->jobs = NULL;
+	ld->job_count = 0;
+	ld->next = 0;
+	ld->quit = false;
+	ld->done = NULL;
+	return;
+}
+
+// reserve a slot for the document at name and show a placeholder there until
+// Green_LoaderStart has it opened; called for all of them before that; returns the slot or -1
+int	Green_OpenLater( Green_RTD *rtd, char *name )
+{
+	Green_Loader	*ld = &rtd->loader;
+	Green_Document	*doc;
+	Green_LoadJob	*tmp;
+	int	i;
+	
+	if (!(tmp = realloc( ld->jobs, (ld->job_count + 1) * sizeof( *tmp ) )))
+		return -1;
+	
+	ld->jobs = tmp;
+	if (!(doc = calloc( 1, sizeof( *doc ) )))
+		return -1;
+	
+	// the only field of a placeholder is its uri, doc->doc is NULL
+	if (!(doc->uri = DocumentURI( name )) || (i = DocumentSlot( rtd, doc )) < 0)
+	{
+		free( doc->uri );
+		free( doc );
+		return -1;
+	}
+	
+	tmp = &ld->jobs[ld->job_count++];
+	tmp->placeholder = doc;
+	tmp->doc = NULL;
+	tmp->name = name;
+	tmp->id = i;
+	tmp->opened = false;
+	return i;
+}
+
+// open the documents reserved by Green_OpenLater in parallel, in the order
+// they were given; done is called from a worker whenever one is opened
+void	Green_LoaderStart( Green_RTD *rtd, void (*done)( void ) )
+{
+	Green_Loader	*ld = &rtd->loader;
+	int	i, n = g_get_num_processors();
+	
+	ld->done = done;
+	n = n < 1 ? 1 : n > LOADER_THREADS ? LOADER_THREADS : n;
+	n = n > ld->job_count ? ld->job_count : n;
+	if (!n || !(ld->threads = malloc( n * sizeof( *ld->threads ) )))
+		return;
+	
+	for (i = 0; i < n; i++)
+		if ((ld->threads[ld->thread_count] = g_thread_try_new( "open", LoaderThread, rtd, NULL )))
+			ld->thread_count++;
+	
+	// without workers the documents are opened right here
+	if (!ld->thread_count)
+		LoaderThread( rtd );
+	
+	return;
+}
+
+// replace the placeholders of the documents opened by now; returns true if
+// the current document is among them
+bool	Green_LoaderCollect( Green_RTD *rtd )
+{
+	Green_Loader	*ld = &rtd->loader;
+	Green_LoadJob	*job;
+	bool	res = false;
+	int	i;
+	
+	g_mutex_lock( &ld->lock );
+	for (i = 0; i < ld->job_count; i++)
+	{
+		job = &ld->jobs[i];
+		if (!job->opened || !job->placeholder)
+			continue;
+		
+		if (!job->doc)
+			fprintf( stderr, "Failed to open: %s\n", job->name );
+		
+		rtd->docs[job->id] = job->doc;
+		free( job->placeholder->uri );
+		free( job->placeholder );
+		job->placeholder = NULL;
+		
+		// instead of a document that failed, the next one is shown
+		if (job->id == rtd->doc_cur)
+		{
+			if (!job->doc)
+				Green_NextVaildDoc( rtd );
+			
+			res = true;
+		}
+		else if (job->doc && !rtd->docs[rtd->doc_cur])
+		{
+			rtd->doc_cur = job->id;
+			res = true;
+		}
+	}
+	
+	g_mutex_unlock( &ld->lock );
+	return res;
+}
+
+// waits for the documents being opened, those not opened yet are dropped
+void	Green_LoaderStop( Green_RTD *rtd )
+{
+	Green_Loader	*ld = &rtd->loader;
+	int	i;
+	
+	g_mutex_lock( &ld->lock );
+	ld->quit = true;
+	g_mutex_unlock( &ld->lock );
+	for (i = 0; i < ld->thread_count; i++)
+		g_thread_join( ld->threads[i] );
+	
+	for (i = 0; i < ld->job_count; i++)
+		if (ld->jobs[i].placeholder)
+		{
+			if (ld->jobs[i].doc)
+				DocumentFree( ld->jobs[i].doc );
+			
+			rtd->docs[ld->jobs[i].id] = NULL;
+			free( ld->jobs[i].placeholder->uri );
+			free( ld->jobs[i].placeholder );
+		}
+	
+	free( ld->threads );
+	free( ld->jobs );
+	ld->threads = NULL;
+	ld->thread_count = 0;
+	ld->jobs = NULL;
+	ld->job_count = 0;
+	return;
+}
+
+// watch the files of the documents opened from now on
+void	Green_WatchInit( Green_RTD *rtd )
+{
+	rtd->watch_fd = inotify_init1( IN_NONBLOCK | IN_CLOEXEC );
+	return;
+}
+
+void	Green_WatchStop( Green_RTD *rtd )
+{
+	if (rtd->watch_fd >= 0)
+		close( rtd->watch_fd );
+	
+	rtd->watch_fd = -1;
+	return;
+}
+
+guint64	ReloadHash( guint64 hash, const void *data, size_t len )
+{
+	const unsigned char	*p = data;
+	size_t	i;
+	
+	for (i = 0; i < len; i++)
+		hash = (hash ^ p[i]) * 1099511628211ULL;
+	
+	return hash;
+}
+
+// the text of a page with the boxes of its characters; only the search
+// hits and the text index are moved over to a new version, and they depend
+// on nothing else, while any change to the graphics needs a new render anyway
+guint64	ReloadPrint( Green_PageText *pt )
+{
+	guint64	hash = 14695981039346656037ULL;
+	
+	if (!pt->text)
+		return 0;
+	
+	hash = ReloadHash( hash, pt->text, strlen( pt->text ) + 1 );
+	hash = ReloadHash( hash, pt->boxes, pt->chars * sizeof( *pt->boxes ) );
+	
+	// 0 means no fingerprint
+	return hash ? hash : 1;
+}
+
+// the pages around page, which are matched before the swap
+void	ReloadRange( int page, int *lo, int *hi )
+{
+	*lo = page > RELOAD_NEAR ? page - RELOAD_NEAR : 0;
+	*hi = page + RELOAD_NEAR + 1;
+	return;
+}
+
+// the text of an old page comes from its index if that has it by now
+void	ReloadPrints( ReloadJob *job, PopplerDocument *old, PopplerDocument *doc, int page_nr )
+{
+	Green_PageText	pt;
+	PopplerPage	*page;
+	
+	if (page_nr < job->old->page_count && page_nr < Green_IndexProgress( &job->old->index ))
+		job->old_prints[page_nr] = ReloadPrint( &job->old->index.pages[page_nr] );
+	else if (page_nr < job->old->page_count)
+	{
+		page = poppler_document_get_page( old, page_nr );
+		if (Green_IndexExtract( page, &pt ))
+		{
+			job->old_prints[page_nr] = ReloadPrint( &pt );
+			free( pt.text );
+			free( pt.boxes );
+		}
+		
+		g_object_unref( G_OBJECT( page ) );
+	}
+	
+	if (page_nr < job->doc->page_count)
+	{
+		page = poppler_document_get_page( doc, page_nr );
+		if (Green_IndexExtract( page, &job->texts[page_nr] ))
+			job->new_prints[page_nr] = ReloadPrint( &job->texts[page_nr] );
+		
+		g_object_unref( G_OBJECT( page ) );
+	}
+	
+	return;
+}
+
+// opens the new version without indexing it and takes the fingerprints of
+// both, those around the current page first so the swap need not wait for the
+// others; the text extracted of the new version is kept for its index
+gpointer	ReloadThread( gpointer data )
+{
+	ReloadJob	*job = data;
+	PopplerDocument	*old = NULL, *doc = NULL;
+	char	*uri = strdup( job->old->uri );
+	int	i, n, lo, hi, old_n = job->old->page_count, new_n;
+	
+	if (!(job->doc = uri ? DocumentOpen( job->rtd, uri, NULL, 0, false, false ) : NULL))
+	{
+		g_atomic_int_set( &job->stage, RELOAD_FINISHED );
+		return NULL;
+	}
+	
+	new_n = job->doc->page_count;
+	job->old_prints = calloc( old_n ? old_n : 1, sizeof( *job->old_prints ) );
+	job->new_prints = calloc( new_n ? new_n : 1, sizeof( *job->new_prints ) );
+	if ((job->texts = calloc( new_n ? new_n : 1, sizeof( *job->texts ) )))
+		job->text_count = new_n;
+	
+	job->taken = calloc( new_n ? new_n : 1, sizeof( *job->taken ) );
+	job->map = malloc( (old_n ? old_n : 1) * sizeof( *job->map ) );
+	if (job->old_prints && job->new_prints && job->texts && job->taken && job->map)
+	{
+		old = Green_AcquireDocument( job->old );
+		doc = Green_AcquireDocument( job->doc );
+	}
+	
+	// without fingerprints the new version is shown all the same, only nothing carries over
+	if (!old || !doc)
+	{
+		free( job->map );
+		job->map = NULL;
+	}
+	
+	for (i = 0; job->map && i < old_n; i++)
+		job->map[i] = -1;
+	
+	ReloadRange( job->page, &lo, &hi );
+	for (i = lo; job->map && i < hi; i++)
+		ReloadPrints( job, old, doc, i );
+	
+	g_atomic_int_set( &job->stage, RELOAD_NEARBY );
+	n = old_n > new_n ? old_n : new_n;
+	for (i = 0; job->map && i < n && !g_atomic_int_get( &job->quit ); i++)
+		if (i < lo || i >= hi)
+			ReloadPrints( job, old, doc, i );
+	
+	if (old)
+		Green_ReleaseDocument( job->old, old );
+	
+	if (doc)
+		Green_ReleaseDocument( job->doc, doc );
+	
+	g_atomic_int_set( &job->stage, RELOAD_FINISHED );
+	return NULL;
+}
+
+gpointer	ReloadKey( guint64 print )
+{
+	return GUINT_TO_POINTER( (guint)(print ^ print >> 32) );
+}
+
+// match the old pages in [lo, hi) not matched yet to new pages of the same
+// range by their fingerprints, wherever they moved to; returns the new page
+// of every old page matched now, -1 for the others
+int*	ReloadMatch( ReloadJob *job, int lo, int hi )
+{
+	GHashTable	*prints;
+	gpointer	value;
+	guint64	print;
+	int	*moves, i, j,
+		old_n = job->old->page_count < hi ? job->old->page_count : hi,
+		new_n = job->doc->page_count < hi ? job->doc->page_count : hi;
+	
+	if (!job->map || !(moves = malloc( (job->old->page_count ? job->old->page_count : 1) * sizeof( *moves ) )))
+		return NULL;
+	
+	for (i = 0; i < job->old->page_count; i++)
+		moves[i] = -1;
+	
+	// most pages stay where they were
+	for (i = lo; i < old_n && i < new_n; i++)
+		if (job->map[i] < 0 && !job->taken[i] && job->old_prints[i] && job->old_prints[i] == job->new_prints[i])
+		{
+			job->map[i] = moves[i] = i;
+			job->taken[i] = true;
+		}
+	
+	// of equal pages the first one is found
+	prints = g_hash_table_new( g_direct_hash, g_direct_equal );
+	for (j = new_n - 1; j >= lo; j--)
+		if (!job->taken[j] && job->new_prints[j])
+			g_hash_table_replace( prints, ReloadKey( job->new_prints[j] ), GINT_TO_POINTER( j + 1 ) );
+	
+	for (i = lo; i < old_n; i++)
+	{
+		print = job->old_prints[i];
+		if (job->map[i] >= 0 || !print || !(value = g_hash_table_lookup( prints, ReloadKey( print ) )))
+			continue;
+		
+		j = GPOINTER_TO_INT( value ) - 1;
+		if (!job->taken[j] && job->new_prints[j] == print)
+		{
+			job->map[i] = moves[i] = j;
+			job->taken[j] = true;
+		}
+	}
+	
+	g_hash_table_destroy( prints );
+	return moves;
+}
+
+// hand the search hits of the old pages in moves on to the new version; they
+// only go where the new version has not searched yet for the same string
+void	ReloadMove( ReloadJob *job, int *moves )
+{
+	Green_Document	*old = job->old, *doc = job->doc;
+	Green_Hits	*hits;
+	int	i;
+	
+	if (!old->hits || !doc->hits || !job->hits_str || !doc->hits_str || strcmp( job->hits_str, doc->hits_str ))
+		return;
+	
+	for (i = 0; i < old->page_count; i++)
+	{
+		if (moves[i] < 0 || (hits = &doc->hits[moves[i]])->count >= 0)
+			continue;
+		
+		*hits = old->hits[i];
+		old->hits[i].rects = NULL;
+		old->hits[i].count = -1;
+	}
+	
+	return;
+}
+
+// put the new version in the slot of the old one, with the view of the old one
+// and whatever belongs to the pages around the current one that did not change;
+// the old version stays with the job until the other pages are matched
+void	ReloadSwap( Green_RTD *rtd, int id )
+{
+	Green_Document	*old = rtd->docs[id];
+	ReloadJob	*job = old->reload.job;
+	Green_Document	*doc = job->doc;
+	int	*moves, i, lo, hi;
+	
+	Green_PrefetchCancel( &rtd->prefetch, old );
+	Green_SearchCancel( &rtd->search, old );
+	doc->page_cur = old->page_cur < doc->page_count ? old->page_cur : doc->page_count ? doc->page_count - 1 : 0;
+	doc->xoffset = old->xoffset;
+	doc->yoffset = old->yoffset;
+	doc->mirrored = old->mirrored;
+	doc->rotation = old->rotation;
+	doc->fit_method = old->fit_method;
+	doc->finescale = old->finescale;
+	doc->continuous = old->continuous;
+	doc->gap = old->gap;
+	doc->bb = old->bb;
+	doc->search_str = old->search_str;
+	old->search_str = NULL;
+	if (old->hits && doc->page_count && (doc->hits = malloc( doc->page_count * sizeof( *doc->hits ) )))
+	{
+		for (i = 0; i < doc->page_count; i++)
+		{
+			doc->hits[i].rects = NULL;
+			doc->hits[i].count = -1;
+		}
+		
+		doc->hits_str = old->hits_str;
+		old->hits_str = NULL;
+		job->hits_str = doc->hits_str ? strdup( doc->hits_str ) : NULL;
+	}
+	
+	ReloadRange( job->page, &lo, &hi );
+	if ((moves = ReloadMatch( job, lo, hi )))
 	{
-		free( uri );
-		free( wd );
-		return NULL;
+		ReloadMove( job, moves );
+		free( moves );
 	}
 	
-	if (abs)
-		sprintf( uri, "%s%s", prefix, filename ); 
-	else
+	doc->reload.thread = old->reload.thread;
+	doc->reload.job = job;
+	old->reload.thread = NULL;
+	old->reload.job = NULL;
+	job->swapped = true;
+	rtd->docs[id] = doc;
+	return;
+}
+
+// once all fingerprints are taken, the rest of the pages are matched and the
+// old version goes
+void	ReloadFinish( Green_Document *doc )
+{
+	ReloadJob	*job = doc->reload.job;
+	int	*moves;
+	
+	g_thread_join( doc->reload.thread );
+	if ((moves = ReloadMatch( job, 0, INT_MAX )))
 	{
-		sprintf( uri, "%s%s/%s", prefix, wd, filename );
-		free( wd );
+		ReloadMove( job, moves );
+		free( moves );
 	}
 	
-	return uri;
+	// the text extracted for the fingerprints is not extracted again
+	Green_IndexBuild( doc, job->texts );
+	job->texts = NULL;
+	DocumentFree( job->old );
+	ReloadJobFree( job );
+	doc->reload.thread = NULL;
+	doc->reload.job = NULL;
+	return;
 }
 
-void	Green_GetScrollRegion( Green_Document *doc, int w, int h, int *scroll_w, int *scroll_h )
+// a reload that failed or is outdated, the document stays as it is
+void	ReloadDrop( Green_Document *doc )
 {
-	PopplerPage	*page;
+	ReloadJob	*job = doc->reload.job;
 	
-	page = poppler_document_get_page( doc->doc, doc->page_cur );
-	Green_GetDimension( page, scroll_w, scroll_h, Green_Fit( doc, w, h ) * doc->finescale, doc->rotation % 2 );
-	g_object_unref( G_OBJECT( page ) );
-	if (*scroll_w < w)
-		*scroll_w = 0;
-	else	
-		*scroll_w -= w;
+	g_atomic_int_set( &job->quit, 1 );
+	g_thread_join( doc->reload.thread );
+	if (job->doc)
+		DocumentFree( job->doc );
 	
-	if (*scroll_h < h)
-		*scroll_h = 0;
-	else	
-		*scroll_h -= h;
+	ReloadJobFree( job );
+	doc->reload.thread = NULL;
+	doc->reload.job = NULL;
+	return;
+}
+
+void	ReloadStart( Green_RTD *rtd, Green_Document *doc )
+{
+	ReloadJob	*job = calloc( 1, sizeof( *job ) );
+	
+	if (!job)
+		return;
+	
+	job->rtd = rtd;
+	job->old = doc;
+	job->page = doc->page_cur;
+	if (!(doc->reload.thread = g_thread_try_new( "reload", ReloadThread, job, NULL )))
+	{
+		free( job );
+		return;
+	}
 	
+	doc->reload.job = job;
+	doc->reload.changed = 0;
 	return;
 }
 
-int	Green_Open( Green_RTD *rtd, char *uri )
+// true if doc is in a slot or is the old version a reload still holds
+bool	Green_IsDocAlive( Green_RTD *rtd, Green_Document *doc )
 {
-	Green_Document	**tmp, *doc = malloc( sizeof( *doc ) );
+	ReloadJob	*job;
 	int	i;
 	
-	if (!doc)
-		return -1;
+	for (i = 0; i < rtd->doc_count; i++)
+		if (Green_IsDocValid( rtd, i ) && (rtd->docs[i] == doc
+			|| ((job = rtd->docs[i]->reload.job) && job->swapped && job->old == doc)))
+			return true;
 	
-	if (!strncmp( uri, "file:", 5 ))
-		doc->uri = strdup( uri );
-	else
-		doc->uri = FilenameToURI( uri );
+	return false;
+}
+
+// take in the changes of the watched files and put the documents reloaded by
+// now in place; a file is reopened once it rested for RELOAD_SETTLE, and a
+// version that failed to open or changed again meanwhile is dropped, so a half
+// written file never replaces a document; true if the current one was replaced
+bool	Green_ReloadPoll( Green_RTD *rtd )
+{
+	char	buf[4096] __attribute__(( aligned( __alignof__( struct inotify_event ) ) ));
+	struct inotify_event	*event;
+	Green_Document	*doc;
+	ReloadJob	*job;
+	gint64	now = g_get_monotonic_time();
+	ssize_t	n;
+	char	*p;
+	bool	res = false;
+	int	i, stage;
 	
-	if (!doc->uri)
-	{
-		free( doc );
-		return -1;
-	}
+	if (rtd->watch_fd < 0)
+		return false;
 	
-	doc->doc = poppler_document_new_from_file( doc->uri, NULL, NULL );
-	if (!doc->doc)
-	{
-		free( doc->uri );
-		free( doc );
-		return -2;
-	}
+	while ((n = read( rtd->watch_fd, buf, sizeof( buf ) )) > 0)
+		for (p = buf; p < buf + n; p += sizeof( *event ) + event->len)
+		{
+			event = (struct inotify_event*)p;
+			for (i = 0; i < rtd->doc_count && event->len; i++)
+				if (Green_IsDocValid( rtd, i ) && rtd->docs[i]->reload.watch == event->wd
+					&& rtd->docs[i]->reload.name && !strcmp( event->name, rtd->docs[i]->reload.name ))
+					rtd->docs[i]->reload.changed = now;
+		}
 	
-	doc->page_count = poppler_document_get_n_pages( doc->doc );
-	doc->page_cur = 0;
-	doc->xoffset = 0;
-	doc->yoffset = 0;
-	doc->mirrored = false;
-	doc->rotation = 0;
-	doc->fit_method = rtd->fit_method;
-	doc->finescale = 1;
-	doc->search_str = NULL;
-	doc->bb = rtd->bb;
-	doc->cache.page = -1;
-	doc->cache.tscale = 0;
-	doc->cache.surface = NULL;
 	for (i = 0; i < rtd->doc_count; i++)
 	{
-		if (rtd->docs[i])
+		if (!Green_IsDocValid( rtd, i ))
 			continue;
 		
-		rtd->docs[i] = doc;
-		return i;
+		doc = rtd->docs[i];
+		if ((job = doc->reload.job))
+		{
+			stage = g_atomic_int_get( &job->stage );
+			if (job->swapped && stage == RELOAD_FINISHED)
+				ReloadFinish( doc );
+			else if (!job->swapped && stage >= RELOAD_NEARBY && (!job->doc || doc->reload.changed))
+				ReloadDrop( doc );
+			else if (!job->swapped && stage >= RELOAD_NEARBY)
+			{
+				ReloadSwap( rtd, i );
+				res = res || i == rtd->doc_cur;
+				continue;
+			}
+		}
+		
+		if (!doc->reload.job && doc->reload.changed && now - doc->reload.changed >= RELOAD_SETTLE)
+			ReloadStart( rtd, doc );
 	}
 	
-	i = rtd->doc_count;
-	tmp = realloc( rtd->docs, (rtd->doc_count + 1) * sizeof( *tmp ) );
-	if (!tmp)
+	return res;
+}
+
+// scale that fits a page of pwidth x pheight points into w x h as doc is shown
+double	Green_FitSize( Green_Document *doc, double pwidth, double pheight, int w, int h )
+{
+	double	tmp;
+	
+	if (doc->rotation % 2)
 	{
-		g_object_unref( G_OBJECT( doc->doc ) );
-		free( doc->uri );
-		free( doc );
-		return -1;
+		tmp = pwidth;
+		pwidth = pheight;
+		pheight = tmp;
 	}
 	
-	tmp[i] = doc;
-	rtd->docs = tmp;
-	rtd->doc_count++;
-	return i;
+	if (doc->fit_method == WIDTH)
+		return w / pwidth;
+	else if (doc->fit_method == HEIGHT)
+		return h / pheight;
+	else if (doc->fit_method == PAGE)
+		return (w / pwidth <= h / pheight) ? w / pwidth : h / pheight;
+	
+	return 1;
 }
 
-void	Green_Close( Green_RTD *rtd, int id )
+// in continuous mode all pages share one scale, fitted to the largest known page
+double	Green_Fit( Green_Document *doc, int w, int h )
 {
-	int	n;
-	
-	if (id < 0 || id >= rtd->doc_count || !rtd->docs[id])
-		return;
+	if (doc->fit_method == NATURAL)
+		return 1;
 	
-	g_object_unref( G_OBJECT( rtd->docs[id]->doc ) );
-	free( rtd->docs[id]->search_str );
-	free( rtd->docs[id] );
-	rtd->docs[id] = NULL;
-	if (id < rtd->doc_count - 1)
-		return;
+	// against the pages known so far, which always covers the chunk around
+	// the current page, so a fit never looks up the size of every page
+	if (doc->continuous && GeometryFill( doc, doc->page_cur ))
+		return Green_FitSize( doc, doc->geometry.max_width, doc->geometry.max_height, w, h );
 	
-	for (n = id; n > 0 && !rtd->docs[n-1]; n-- );
-	rtd->doc_count = n;
-	rtd->docs = realloc( rtd->docs, n * sizeof( *rtd->docs ) );
-	return;
+	return Green_FitPage( doc, doc->page_cur, w, h );
 }
 
-double	Green_Fit( Green_Document *doc, int w, int h )
+double	Green_FitPage( Green_Document *doc, int page_nr, int w, int h )
 {
-	PopplerPage	*page;
 	double	pwidth, pheight;
 	
 	if (doc->fit_method == NATURAL)
 		return 1;
 	
-	page = poppler_document_get_page( doc->doc, doc->page_cur );
-	if (doc->rotation % 2)
-		poppler_page_get_size( page, &pheight, &pwidth );
-	else
-		poppler_page_get_size( page, &pwidth, &pheight );
+	Green_GetPageSize( doc, page_nr, &pwidth, &pheight );
+	return Green_FitSize( doc, pwidth, pheight, w, h );
+}
+
+// the page of the continuous layout at pos pixels from its top, counting the
+// gap below a page to that page
+int	Green_PageAt( Green_Document *doc, int pos, double tscale )
+{
+	int	lo = 0, hi = doc->page_count - 1, mid;
 	
-	if (doc->fit_method == WIDTH)
-		return w / pwidth;
-	else if (doc->fit_method == HEIGHT)
-		return h / pheight;
-	else if (doc->fit_method == PAGE)
-		return (w / pwidth <= h / pheight) ? w / pwidth : h / pheight;
+	while (lo < hi)
+	{
+		mid = (lo + hi + 1) / 2;
+		if (Green_PageTop( doc, mid, tscale ) <= pos)
+			lo = mid;
+		else
+			hi = mid - 1;
+	}
 	
-	return 1;
+	return lo;
+}
+
+// scroll the continuous layout by (x, y) display pixels and keep it on the display
+void	Green_ScrollContinuous( Green_Document *doc, int x, int y, int w, int h )
+{
+	double	tscale = Green_Fit( doc, w, h ) * doc->finescale;
+	int	pos, end, max_x;
+	
+	pos = Green_PageTop( doc, doc->page_cur, tscale ) + doc->yoffset + y;
+	end = Green_PageTop( doc, doc->page_count, tscale ) - doc->gap - h;
+	if (pos > end)
+		pos = end;
+	
+	if (pos < 0)
+		pos = 0;
+	
+	doc->page_cur = Green_PageAt( doc, pos, tscale );
+	doc->yoffset = pos - Green_PageTop( doc, doc->page_cur, tscale );
+	
+	// the layout is as wide as its widest page, all pages being known by now
+	max_x = (doc->rotation % 2 ? doc->geometry.max_height : doc->geometry.max_width) * tscale - w;
+	doc->xoffset += x;
+	if (doc->xoffset > max_x)
+		doc->xoffset = max_x;
+	
+	if (doc->xoffset < 0)
+		doc->xoffset = 0;
+	
+	return;
 }
 
 void	Green_ScrollRelative( Green_Document *doc, int x, int y, int w, int h, int bb_flag )
@@ -185,6 +1267,12 @@ void	Green_ScrollRelative( Green_Document *doc, int x, int y, int w, int h, int
 		max_x, max_y;
 	bool	left_border, right_border, top_border, bottom_border, bb_done = false;
 		
+	if (doc->continuous)
+	{
+		Green_ScrollContinuous( doc, x, y, w, h );
+		return;
+	}
+	
 	Green_GetScrollRegion( doc, w, h, &max_x, &max_y );
 	if (doc->rotation % 2)
 	{
@@ -391,17 +1479,25 @@ void	Green_ScrollRelative( Green_Document *doc, int x, int y, int w, int h, int
 
 void	Green_Zoom( Green_Document *doc, int width, int height, double new_fs )
 {
-	PopplerPage	*page;
 	double	old_tscale, new_tscale;
-	int	old_w, old_h, new_w, new_h;
+	int	old_w, old_h, new_w, new_h, pos;
 	
-	page = poppler_document_get_page( doc->doc, doc->page_cur );
 	old_tscale = Green_Fit(doc, width, height) * doc->finescale;
 	doc->finescale = new_fs;
 	new_tscale = Green_Fit(doc, width, height) * new_fs;
-	Green_GetDimension( page, &old_w, &old_h, old_tscale, doc->rotation % 2 );
-	Green_GetDimension( page, &new_w, &new_h, new_tscale, doc->rotation % 2 );
-	g_object_unref( G_OBJECT( page ) );
+	if (doc->continuous)
+	{
+		// keep the middle of the display in place, counting from the top of the layout
+		pos = Green_PageTop( doc, doc->page_cur, old_tscale ) + doc->yoffset + height / 2;
+		doc->page_cur = 0;
+		doc->yoffset = pos * new_tscale / old_tscale - height / 2;
+		doc->xoffset = (doc->xoffset + width / 2) * new_tscale / old_tscale - width / 2;
+		Green_ValidateOffset( doc, width, height );
+		return;
+	}
+	
+	Green_GetPageDimension( doc, doc->page_cur, &old_w, &old_h, old_tscale, doc->rotation % 2 );
+	Green_GetPageDimension( doc, doc->page_cur, &new_w, &new_h, new_tscale, doc->rotation % 2 );
 	
 	if (doc->rotation % 2 == 0)
 		doc->xoffset = doc->xoffset * new_tscale / old_tscale
@@ -421,24 +1517,290 @@ void	Green_Zoom( Green_Document *doc, int width, int height, double new_fs )
 	return;
 }
 
+// first page with hits in [from, to), asking poppler for the pages not indexed yet
+int	FindRange( Green_Document *doc, const char *query, int from, int to )
+{
+	Green_Hits	*hits;
+	int	i, done = Green_IndexProgress( &doc->index );
+	
+	if (query && from < done && (i = Green_IndexFind( &doc->index, query, from, to < done ? to : done )) >= 0)
+		return i;
+	
+	for (i = from > done ? from : done; i < to; i++)
+	{
+		hits = Green_GetHits( doc, NULL, i );
+		if (hits && hits->count > 0)
+			return i;
+	}
+	
+	return -1;
+}
+
 int	Green_FindNext( Green_Document *doc, int start )
 {
-	PopplerPage	*page;
-	GList	*list;
-	int	i, res = -1;
+	char	*query;
+	int	res;
+	
+	if (!doc->search_str)
+		return -1;
+	
+	start %= doc->page_count;
+	query = Green_IndexFold( doc->search_str );
+	res = FindRange( doc, query, start, doc->page_count );
+	if (res < 0)
+		res = FindRange( doc, query, 0, start );
+	
+	free( query );
+	return res;
+}
+
+void	Green_ClearHits( Green_Document *doc )
+{
+	int	i;
+	
+	if (doc->hits)
+		for (i = 0; i < doc->page_count; i++)
+			free( doc->hits[i].rects );
+	
+	free( doc->hits );
+	free( doc->hits_str );
+	doc->hits = NULL;
+	doc->hits_str = NULL;
+	return;
+}
+
+// returns the hits of doc->search_str on page page_nr, searching it on first use;
+// page may be NULL if the caller has not loaded it
+Green_Hits*	Green_GetHits( Green_Document *doc, PopplerPage *page, int page_nr )
+{
+	Green_Hits	*hits;
+	PopplerRectangle	*rect;
+	GList	*list, *item;
+	double	pwidth, pheight;
+	char	*query;
+	int	i;
+	
+	if (!doc->search_str)
+		return NULL;
 	
-	for (i = 0; i < doc->page_count; i++)
+	if (!doc->hits_str || strcmp( doc->hits_str, doc->search_str ))
 	{
-		page = poppler_document_get_page( doc->doc, (start + i) % doc->page_count );
-		list = poppler_page_find_text( page, doc->search_str );
-		g_object_unref( G_OBJECT( page ) );
-		if (list)
+		Green_ClearHits( doc );
+		doc->hits = malloc( doc->page_count * sizeof( *doc->hits ) );
+		doc->hits_str = strdup( doc->search_str );
+		if (!doc->hits || !doc->hits_str)
+		{
+			Green_ClearHits( doc );
+			return NULL;
+		}
+		
+		for (i = 0; i < doc->page_count; i++)
 		{
-			g_list_free( list );
-			res = (start + i) % doc->page_count;
-			break;
+			doc->hits[i].rects = NULL;
+			doc->hits[i].count = -1;
 		}
 	}
 	
-	return res;
+	hits = &doc->hits[page_nr];
+	if (hits->count >= 0)
+		return hits;
+	
+	if (page_nr < Green_IndexProgress( &doc->index ) && (query = Green_IndexFold( doc->search_str )))
+	{
+		hits->count = Green_IndexHits( &doc->index, page_nr, query, &hits->rects );
+		free( query );
+		if (hits->count >= 0)
+			return hits;
+	}
+	
+	if (page)
+		g_object_ref( G_OBJECT( page ) );
+	else
+		page = poppler_document_get_page( doc->doc, page_nr );
+	
+	poppler_page_get_size( page, &pwidth, &pheight );
+	list = poppler_page_find_text( page, doc->search_str );
+	g_object_unref( G_OBJECT( page ) );
+	hits->count = 0;
+	hits->rects = malloc( g_list_length( list ) * sizeof( *hits->rects ) );
+	for (item = list; item; item = item->next)
+	{
+		rect = item->data;
+		if (hits->rects)
+		{
+			// poppler counts y from the bottom of the page
+			hits->rects[hits->count].x1 = rect->x1;
+			hits->rects[hits->count].y1 = pheight - rect->y2;
+			hits->rects[hits->count].x2 = rect->x2;
+			hits->rects[hits->count].y2 = pheight - rect->y1;
+			hits->count++;
+		}
+		
+		poppler_rectangle_free( rect );
+	}
+	
+	g_list_free( list );
+	return hits;
+}
+
+// render the rectangle (x, y, w, h) of the page scaled by tscale on white
+cairo_surface_t*	Green_RenderRegion( PopplerPage *page, double tscale, int x, int y, int w, int h )
+{
+	cairo_surface_t	*surface;
+	cairo_t	*context;
+	
+	surface = cairo_image_surface_create( CAIRO_FORMAT_ARGB32, w, h );
+	context = cairo_create( surface );
+	cairo_save( context );
+	cairo_translate( context, -x, -y );
+	cairo_scale( context, tscale, tscale );
+	poppler_page_render( page, context );
+	cairo_restore( context );
+	cairo_set_operator( context, CAIRO_OPERATOR_DEST_OVER );
+	cairo_set_source_rgb( context, 1., 1., 1. );
+	cairo_paint( context );
+	cairo_destroy( context );
+	return surface;
+}
+
+// copy every tile that is completely covered by surface into the cache,
+// the top left of surface being the page pixel (x, y) of a pw x ph page
+void	Green_CacheRegion( Green_PageCache *cache, int page_nr, double tscale, cairo_surface_t *surface, int x, int y, int pw, int ph )
+{
+	cairo_surface_t	*tile;
+	unsigned char	*src, *dst;
+	int	tx, ty, tx1, ty1, tx2, ty2, tw, th, row, w, h;
+	
+	w = cairo_image_surface_get_width( surface );
+	h = cairo_image_surface_get_height( surface );
+	tx1 = (x + GREEN_TILE_SIZE - 1) / GREEN_TILE_SIZE;
+	ty1 = (y + GREEN_TILE_SIZE - 1) / GREEN_TILE_SIZE;
+	tx2 = x + w >= pw ? (pw - 1) / GREEN_TILE_SIZE : (x + w) / GREEN_TILE_SIZE - 1;
+	ty2 = y + h >= ph ? (ph - 1) / GREEN_TILE_SIZE : (y + h) / GREEN_TILE_SIZE - 1;
+	for (ty = ty1; ty <= ty2; ty++)
+	{
+		for (tx = tx1; tx <= tx2; tx++)
+		{
+			if (Green_CacheContains( cache, page_nr, tscale, tx, ty ))
+				continue;
+			
+			tw = pw - tx * GREEN_TILE_SIZE < GREEN_TILE_SIZE ? pw - tx * GREEN_TILE_SIZE : GREEN_TILE_SIZE;
+			th = ph - ty * GREEN_TILE_SIZE < GREEN_TILE_SIZE ? ph - ty * GREEN_TILE_SIZE : GREEN_TILE_SIZE;
+			tile = cairo_image_surface_create( cairo_image_surface_get_format( surface ), tw, th );
+			src = cairo_image_surface_get_data( surface )
+				+ (ty * GREEN_TILE_SIZE - y) * cairo_image_surface_get_stride( surface )
+				+ (tx * GREEN_TILE_SIZE - x) * 4;
+			dst = cairo_image_surface_get_data( tile );
+			for (row = 0; row < th; row++)
+				memcpy( dst + row * cairo_image_surface_get_stride( tile ),
+					src + row * cairo_image_surface_get_stride( surface ), tw * 4 );
+			
+			cairo_surface_mark_dirty( tile );
+			Green_CacheInsert( cache, page_nr, tscale, tx, ty, tile );
+		}
+	}
+	
+	return;
+}
+
+// make sure all tiles intersecting (x, y, w, h) are in the cache; the missing
+// ones are rendered in a single pass as poppler interprets the whole page anyway
+void	Green_RenderTiles( Green_PageCache *cache, PopplerPage *page, int page_nr, double tscale, int x, int y, int w, int h )
+{
+	cairo_surface_t	*surface;
+	int	tx, ty, tx1, ty1, tx2, ty2, mx1, my1, mx2, my2, pw, ph, bx, by, bw, bh;
+	
+	Green_GetDimension( page, &pw, &ph, tscale, false );
+	if (x < 0)
+	{
+		w += x;
+		x = 0;
+	}
+	
+	if (y < 0)
+	{
+		h += y;
+		y = 0;
+	}
+	
+	if (x + w > pw)
+		w = pw - x;
+	
+	if (y + h > ph)
+		h = ph - y;
+	
+	if (w <= 0 || h <= 0)
+		return;
+	
+	tx1 = x / GREEN_TILE_SIZE;
+	ty1 = y / GREEN_TILE_SIZE;
+	tx2 = (x + w - 1) / GREEN_TILE_SIZE;
+	ty2 = (y + h - 1) / GREEN_TILE_SIZE;
+	mx1 = tx2 + 1;
+	my1 = ty2 + 1;
+	mx2 = my2 = -1;
+	for (ty = ty1; ty <= ty2; ty++)
+		for (tx = tx1; tx <= tx2; tx++)
+			if (!Green_CacheContains( cache, page_nr, tscale, tx, ty ))
+			{
+				mx1 = tx < mx1 ? tx : mx1;
+				my1 = ty < my1 ? ty : my1;
+				mx2 = tx > mx2 ? tx : mx2;
+				my2 = ty > my2 ? ty : my2;
+			}
+	
+	if (mx2 < 0)
+		return;
+	
+	bx = mx1 * GREEN_TILE_SIZE;
+	by = my1 * GREEN_TILE_SIZE;
+	bw = ((mx2 + 1) * GREEN_TILE_SIZE < pw ? (mx2 + 1) * GREEN_TILE_SIZE : pw) - bx;
+	bh = ((my2 + 1) * GREEN_TILE_SIZE < ph ? (my2 + 1) * GREEN_TILE_SIZE : ph) - by;
+	surface = Green_RenderRegion( page, tscale, bx, by, bw, bh );
+	cairo_surface_flush( surface );
+	Green_CacheRegion( cache, page_nr, tscale, surface, bx, by, pw, ph );
+	cairo_surface_destroy( surface );
+	return;
+}
+
+// poppler documents must not be shared between threads, so every worker
+// borrows its own instance of the file
+PopplerDocument*	Green_AcquireDocument( Green_Document *doc )
+{
+	PopplerDocument	*pdoc = NULL;
+	
+	g_mutex_lock( &doc->lock );
+	if (doc->pool_count)
+		pdoc = doc->pool[--doc->pool_count];
+	
+	g_mutex_unlock( &doc->lock );
+	// instances of a document in memory share its bytes
+	if (!pdoc && doc->data)
+		pdoc = poppler_document_new_from_data( doc->data, doc->data_size, NULL, NULL );
+	else if (!pdoc)
+		pdoc = poppler_document_new_from_file( doc->uri, NULL, NULL );
+	
+	return pdoc;
+}
+
+void	Green_ReleaseDocument( Green_Document *doc, PopplerDocument *pdoc )
+{
+	PopplerDocument	**tmp;
+	
+	if (!pdoc)
+		return;
+	
+	g_mutex_lock( &doc->lock );
+	tmp = realloc( doc->pool, (doc->pool_count + 1) * sizeof( *tmp ) );
+	if (tmp)
+	{
+		tmp[doc->pool_count++] = pdoc;
+		doc->pool = tmp;
+	}
+	
+	g_mutex_unlock( &doc->lock );
+	if (!tmp)
+		g_object_unref( G_OBJECT( pdoc ) );
+	
+	return;
 }
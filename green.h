@@ -19,10 +19,20 @@
 
 
 #include <stdbool.h>
+#include <stddef.h>
 #include "glib/poppler.h"
 
 
 #define GREEN_FULLSCREEN	0x0001
+#define GREEN_CONTINUOUS	0x0002
+#define GREEN_HEADLESS	0x0004	// no display, documents are opened without a text index
+#define GREEN_RELOAD	0x0008	// watch the files of the documents and reload them when they change
+
+#define GREEN_TILE_SIZE	256	// edge length of cached page tiles in pixels
+#define GREEN_DRAFT_FACTOR	4	// a draft is rendered at 1/GREEN_DRAFT_FACTOR of the scale
+#define GREEN_THUMB_SIZE	128	// longest edge of page thumbnails in pixels
+
+#define GREEN_BOX_UNIT	4	// character boxes are stored in 1/GREEN_BOX_UNIT points
 
 
 typedef enum
@@ -37,18 +47,134 @@ typedef struct
 	
 }	Green_RGBA;
 
-typedef struct
+typedef struct Green_PageBuffer
 {
 	int	page;
 	double	tscale;
+	int	tx, ty;	// tile position in units of GREEN_TILE_SIZE
 	cairo_surface_t	*surface;
+	size_t	size;	// bytes held by surface
+	struct Green_PageBuffer	*prev, *next;
 	
 }	Green_PageBuffer;
 
+// rendered tiles kept on disk between runs, shared by all documents
+typedef struct
+{
+	char	*dir;	// NULL if disabled
+	size_t	limit;	// bytes the directory may hold
+	size_t	size;	// bytes in it, valid once scanned
+	bool	scanned;
+	GMutex	lock;	// protects size and scanned
+	
+	// tiles waiting for the writer, so no renderer waits for the disk
+	GThread	*thread;	// NULL until the first tile is queued
+	GMutex	queue_lock;	// protects everything below
+	GCond	queue_cond;
+	struct DiskJob	*first, *last;
+	int	queued;
+	bool	quit;
+	
+}	Green_DiskCache;
+
+typedef struct
+{
+	Green_PageBuffer	*first, *last;	// most recently used first
+	size_t	size, limit;	// bytes in use, eviction threshold
+	unsigned long	hits, misses;
+	Green_DiskCache	*disk;	// NULL if tiles are not kept on disk
+	char	*disk_dir;	// tiles of the document below disk->dir
+	GHashTable	*disk_tiles;	// names of the tiles in disk_dir, so a miss needs no file system
+	unsigned long	used;	// when its document was last on the screen, for the memory limit
+	
+}	Green_PageCache;
+
+typedef struct
+{
+	guint16	x1, y1, x2, y2;	// in 1/GREEN_BOX_UNIT points from the top left of the page
+	
+}	Green_CharBox;
+
+typedef struct
+{
+	char	*text;	// lower case UTF-8 text of the page
+	Green_CharBox	*boxes;	// one per character of text
+	int	chars;
+	
+}	Green_PageText;
+
+typedef struct
+{
+	GThread	*thread;
+	Green_PageText	*pages;	// one per page, valid below done
+	GHashTable	*trigrams;	// trigram -> pages containing it, in ascending order
+	GMutex	lock;	// protects trigrams
+	gint	done, quit;	// pages indexed so far, accessed atomically
+	void	*map;	// cache file all pages point into, NULL if they were extracted
+	size_t	map_size;
+	Green_PageText	*seed;	// per page, text to take over instead of extracting it; NULL if none
+	Green_DiskCache	*disk;	// directory of the cache files
+	
+}	Green_TextIndex;
+
+// page sizes in points, filled in from the first page on as they are needed;
+// only used from the main thread
+typedef struct
+{
+	double	*width, *height;	// per page
+	double	*sum_width, *sum_height;	// of all pages before the index, one more entry than pages
+	double	max_width, max_height;	// over the known pages
+	int	known;	// pages whose size is filled in
+	
+}	Green_Geometry;
+
 typedef struct
 {
-	PopplerDocument	*doc;
-	char	*uri;
+	guint16	*pixels;	// RGB565, NULL if it could not be made
+	guint16	width, height;	// 0 if not made yet
+	
+}	Green_Thumb;
+
+// thumbnails of all pages, made by a worker beginning with the pages on the screen
+typedef struct
+{
+	GThread	*thread;
+	GMutex	lock;	// protects everything below
+	GCond	cond;
+	Green_Thumb	*thumbs;	// one per page
+	int	first, last;	// pages on the screen
+	bool	quit;
+	void	(*done)( void );	// called from the worker when a thumbnail on the screen is made
+	
+}	Green_Thumbnails;
+
+// search hits on one page in points from the top left of the page
+typedef struct
+{
+	PopplerRectangle	*rects;
+	int	count;	// -1 if the page has not been searched yet
+	
+}	Green_Hits;
+
+// a newer version of the file of a document, opened in the background once
+// the file stopped changing
+typedef struct
+{
+	GThread	*thread;	// NULL if no reload runs
+	struct ReloadJob	*job;	// shared with the thread, NULL if none runs
+	gint64	changed;	// monotonic time of the last change not reloaded yet, 0 if none
+	int	watch;	// inotify watch of the directory of the file, -1 if none
+	char	*name;	// of the file in that directory
+	
+}	Green_Reload;
+
+typedef struct Green_Document
+{
+	PopplerDocument	*doc;	// NULL while the document is a placeholder of Green_OpenLater
+	char	*uri;	// "-" for stdin and buffers
+	char	*data;	// the bytes poppler reads, NULL if it reads the file by uri
+	size_t	data_size;
+	bool	mapped;	// is data mapped rather than allocated?
 	int	page_count, page_cur,
 		xoffset, yoffset;
 	bool	mirrored;	// is the document mirrored horizontally?
@@ -59,12 +185,107 @@ typedef struct
 		// 3: rotated right by 270°
 	Green_FitMethod	fit_method;
 	double	finescale;
+	bool	continuous;	// pages stacked below each other, page_cur being the one at the top of the display
+		// and xoffset, yoffset the display pixels the layout is scrolled from its left and page_cur's top
+	int	gap;	// pixels between pages in continuous mode
 	char	*search_str;
+	char	*hits_str;	// search string the hits belong to
+	Green_Hits	*hits;	// page_count entries, NULL if hits_str is NULL
+	Green_TextIndex	index;
+	Green_Geometry	geometry;
+	Green_Thumbnails	thumbs;
 	unsigned char	bb;
-	Green_PageBuffer	cache;
+	Green_PageCache	cache;
+	Green_Reload	reload;
+	GMutex	lock;	// protects pool
+	PopplerDocument	**pool;	// spare instances for worker threads
+	int	pool_count;
 	
 }	Green_Document;
 
+typedef struct
+{
+	GThread	*thread;
+	GMutex	lock;
+	GCond	cond;
+	Green_Document	*doc,	// document of the pending request
+		*busy;	// document the worker is rendering from
+	int	page[2];	// neighbours in the order they are rendered
+	double	tscale[2];
+	int	x[2], y[2];	// top left of the region to render
+	int	width, height;	// size of the region to render, unrotated
+	bool	pending, quit;
+	
+	// the visible region, rendered before any neighbour
+	Green_Document	*cur_doc;	// NULL if there is no such request
+	int	cur_page, cur_x, cur_y, cur_w, cur_h;
+	double	cur_tscale;
+	bool	cur_draft,	// render a draft of the region first
+		cur_busy;	// the worker renders the region the cur_ fields describe
+	unsigned int	generation;	// of the last request for the visible region
+	cairo_surface_t	*draft;	// the last draft, NULL if none
+	unsigned int	draft_generation;
+	int	draft_x, draft_y;	// position of the draft in pixels at its scale
+	void	(*done)( unsigned int generation );	// called from the worker when a draft or the region is done
+	
+}	Green_Prefetch;
+
+typedef struct
+{
+	GThread	**threads;
+	int	thread_count;
+	GMutex	lock;
+	GCond	cond;
+	Green_Document	*doc;	// document being searched, NULL if idle
+	char	*str, *folded;	// search string as given and lower cased for the index
+	int	start, next, best;	// first page, next chunk, first hit as position from start
+	int	active;	// workers inside a chunk
+	unsigned int	generation;	// increased by every start and cancel
+	bool	cancel, quit;
+	Green_Document	*result_doc;	// outcome of the last finished search
+	int	result;	// page or -1
+	void	(*done)( unsigned int generation );	// called from a worker when a search finished
+	
+}	Green_Search;
+
+// settings and totals of the headless export
+typedef struct
+{
+	char	*dir;	// NULL if green runs interactively
+	char	*pages;	// page ranges like "1-3,7,10-", NULL for all
+	double	scale;
+	int	rotation;
+	bool	mirrored, ppm;	// mirror horizontally, write PPM instead of PNG
+	GMutex	lock;	// protects exported and bytes
+	int	exported;
+	guint64	bytes;
+	gint64	start;	// monotonic time the export started
+	
+}	Green_Export;
+
+typedef struct
+{
+	Green_Document	*placeholder;	// in its slot until the document is collected, then NULL
+	Green_Document	*doc;	// the opened document, NULL if it failed
+	char	*name;	// as given
+	int	id;	// slot in rtd->docs
+	bool	opened;
+	
+}	Green_LoadJob;
+
+// the documents given at startup, opened in parallel
+typedef struct
+{
+	GThread	**threads;
+	int	thread_count;
+	GMutex	lock;	// protects the jobs once the workers run
+	Green_LoadJob	*jobs;
+	int	job_count, next;	// jobs, next one to open
+	bool	quit;
+	void	(*done)( void );	// called from a worker when a document was opened or failed
+	
+}	Green_Loader;
+
 typedef struct
 {
 	unsigned short	flags, width, height;
@@ -74,6 +295,15 @@ typedef struct
 	Green_FitMethod	fit_method;
 	double	step, zoomstep;
 	unsigned char	bb;
+	int	gap;	// pixels between pages in continuous mode
+	size_t	cache_limit;	// render cache budget per document in bytes
+	size_t	memory_limit;	// of the render caches of all documents together, 0 if unlimited
+	Green_DiskCache	disk;
+	Green_DiskCache	text;	// text caches, limited to the size of the tile directory
+	Green_Prefetch	prefetch;
+	Green_Search	search;
+	Green_Loader	loader;
+	int	watch_fd;	// inotify instance for the files of the documents, -1 if they are not watched
 	
 	struct
 	{
@@ -92,18 +322,86 @@ typedef struct
 
 
 int	Green_Open( Green_RTD *rtd, char *uri );
+int	Green_OpenData( Green_RTD *rtd, char *data, size_t size, bool mapped );
 void	Green_Close( Green_RTD *rtd, int id );
+void	Green_LoaderInit( Green_Loader *ld );
+int	Green_OpenLater( Green_RTD *rtd, char *name );
+void	Green_LoaderStart( Green_RTD *rtd, void (*done)( void ) );
+bool	Green_LoaderCollect( Green_RTD *rtd );
+void	Green_LoaderStop( Green_RTD *rtd );
 double	Green_Fit( Green_Document *doc, int width, int height );
+double	Green_FitPage( Green_Document *doc, int page, int width, int height );
+double	Green_FitSize( Green_Document *doc, double pwidth, double pheight, int width, int height );
+void	Green_GetPageSize( Green_Document *doc, int page, double *width, double *height );
+double	Green_GetPageStart( Green_Document *doc, int page, bool rotated );
+int	Green_PageAt( Green_Document *doc, int pos, double tscale );
+void	Green_ScrollContinuous( Green_Document *doc, int x, int y, int w, int h );
 void	Green_ScrollRelative( Green_Document *doc, int x, int y, int w, int h, int bb_flag );
 void	Green_GetScrollRegion( Green_Document *doc, int w, int h, int *scroll_w, int *scroll_h );
 void	Green_Zoom( Green_Document *doc, int width, int height, double new_fs );
 int	Green_FindNext( Green_Document *doc, int start );
+Green_Hits*	Green_GetHits( Green_Document *doc, PopplerPage *page, int page_nr );
+void	Green_ClearHits( Green_Document *doc );
+cairo_surface_t*	Green_RenderRegion( PopplerPage *page, double tscale, int x, int y, int w, int h );
+void	Green_CacheRegion( Green_PageCache *cache, int page_nr, double tscale, cairo_surface_t *surface, int x, int y, int pw, int ph );
+void	Green_RenderTiles( Green_PageCache *cache, PopplerPage *page, int page_nr, double tscale, int x, int y, int w, int h );
+PopplerDocument*	Green_AcquireDocument( Green_Document *doc );
+void	Green_ReleaseDocument( Green_Document *doc, PopplerDocument *pdoc );
+
+void	Green_SearchInit( Green_Search *search );
+void	Green_SearchStop( Green_Search *search );
+void	Green_SearchCancel( Green_Search *search, Green_Document *doc );
+unsigned int	Green_SearchStart( Green_Search *search, Green_Document *doc, int start );
+void	Green_WatchInit( Green_RTD *rtd );
+void	Green_WatchStop( Green_RTD *rtd );
+bool	Green_ReloadPoll( Green_RTD *rtd );
+bool	Green_IsDocAlive( Green_RTD *rtd, Green_Document *doc );
+bool	Green_SearchResult( Green_Search *search, unsigned int generation, Green_Document **doc, int *page );
+
+void	Green_IndexStart( Green_Document *doc, Green_DiskCache *disk, bool build );
+void	Green_IndexBuild( Green_Document *doc, Green_PageText *seed );
+bool	Green_IndexExtract( PopplerPage *page, Green_PageText *res );
+void	Green_IndexStop( Green_Document *doc );
+int	Green_IndexProgress( Green_TextIndex *idx );
+char*	Green_IndexFold( const char *str );
+int	Green_IndexFind( Green_TextIndex *idx, const char *query, int from, int to );
+int	Green_IndexHits( Green_TextIndex *idx, int page_nr, const char *query, PopplerRectangle **res );
+bool	Green_FileHash( int fd, guint64 size, guint64 *res );
+
+void	Green_CacheInit( Green_PageCache *cache, size_t limit );
+void	Green_CacheFlush( Green_PageCache *cache );
+void	Green_CacheRelease( Green_PageCache *cache );
+void	Green_CacheSetBudget( size_t limit );
+void	Green_CacheSetCurrent( Green_PageCache *cache, int page );
+void	Green_DiskInit( Green_DiskCache *disk );
+void	Green_DiskStop( Green_DiskCache *disk );
+void	Green_DiskAccount( Green_DiskCache *disk, off_t bytes );
+void	Green_CacheOpenDisk( Green_PageCache *cache, Green_DiskCache *disk, const char *uri );
+cairo_surface_t*	Green_CacheLookup( Green_PageCache *cache, int page, double tscale, int tx, int ty );
+bool	Green_CacheContains( Green_PageCache *cache, int page, double tscale, int tx, int ty );
+void	Green_CacheInsert( Green_PageCache *cache, int page, double tscale, int tx, int ty, cairo_surface_t *surface );
+
+void	Green_ExportInit( Green_Export *ex );
+int	Green_ExportDocument( Green_RTD *rtd, Green_Export *ex, char *name );
+void	Green_ExportSummary( Green_Export *ex );
+
+void	Green_ThumbsInit( Green_Document *doc );
+void	Green_ThumbsStop( Green_Document *doc );
+void	Green_ThumbsShow( Green_Document *doc, int first, int last, void (*done)( void ) );
+Green_Thumb	Green_ThumbGet( Green_Thumbnails *th, int page );
+
+void	Green_PrefetchInit( Green_Prefetch *pf );
+void	Green_PrefetchStop( Green_Prefetch *pf );
+void	Green_PrefetchRequest( Green_RTD *rtd, Green_Document *doc, int width, int height );
+unsigned int	Green_PrefetchCurrent( Green_Prefetch *pf, Green_Document *doc, int page, double tscale, int x, int y, int w, int h, bool draft );
+cairo_surface_t*	Green_PrefetchDraft( Green_Prefetch *pf, unsigned int generation, int *x, int *y );
+void	Green_PrefetchCancel( Green_Prefetch *pf, Green_Document *doc );
 
 
 inline static
 int	Green_IsDocValid( Green_RTD *rtd, int id )
 {
-	return id >= 0 && id < rtd->doc_count && rtd->docs[id];
+	return id >= 0 && id < rtd->doc_count && rtd->docs[id] && rtd->docs[id]->doc;
 }
 
 inline static
@@ -126,11 +424,74 @@ void	Green_GetDimension( PopplerPage *page, int *w, int *h, double tscale, bool
 	return;
 }
 
+// like Green_GetDimension, but from the geometry table of the document
+inline static
+void	Green_GetPageDimension( Green_Document *doc, int page, int *w, int *h, double tscale, bool rotated )
+{
+	double	pwidth, pheight;
+	
+	Green_GetPageSize( doc, page, &pwidth, &pheight );
+	if (rotated)
+	{
+		*w = pheight * tscale;
+		*h = pwidth * tscale;
+	}
+	else
+	{
+		*w = pwidth * tscale;
+		*h = pheight * tscale;
+	}
+	
+	return;
+}
+
+// top of the page in the continuous layout in pixels
+inline static
+int	Green_PageTop( Green_Document *doc, int page, double tscale )
+{
+	return (int)(Green_GetPageStart( doc, page, doc->rotation % 2 ) * tscale) + page * doc->gap;
+}
+
+// how the page is walked for increasing display coordinates,
+// for odd rotations dir_x belongs to the page y axis and dir_y to its x axis
+inline static
+void	Green_GetDirection( Green_Document *doc, int *dir_x, int *dir_y )
+{
+	if (doc->rotation == 1)
+	{
+		*dir_x = -1;
+		*dir_y = 1;
+	}
+	else if (doc->rotation == 2)
+	{
+		*dir_x = -1;
+		*dir_y = -1;
+	}
+	else if (doc->rotation == 3)
+	{
+		*dir_x = 1;
+		*dir_y = -1;
+	}
+	else
+		*dir_x = *dir_y = 1;
+	
+	if (doc->mirrored)
+		*dir_y *= -1;
+	
+	return;
+}
+
 inline static
 void	Green_ValidateOffset( Green_Document *doc, int width, int height )
 {
 	int doc_max_x, doc_max_y;
 	
+	if (doc->continuous)
+	{
+		Green_ScrollContinuous( doc, 0, 0, width, height );
+		return;
+	}
+	
 	if (doc->rotation % 2)
 		Green_GetScrollRegion( doc, width, height, &doc_max_y, &doc_max_x );
 	else
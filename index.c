@@ -0,0 +1,606 @@
+/* green - the PDF reader
+ * Copyright (C) 2009 Florian Tobias Schandinat
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 3.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "green.h"
+
+
+#define CACHE_MAGIC	"green-t1"
+#define CACHE_ALIGN(x)	(((x) + 7) & ~(guint64)7)
+
+
+// pages containing one trigram
+typedef struct
+{
+	int	*pages;
+	int	count, size;
+	
+}	Posting;
+
+// layout of a text cache file: the header, one CachePage per page, then
+// the text of every page with its NUL followed by its boxes, each 8 byte aligned
+typedef struct
+{
+	char	magic[8];
+	guint64	size, hash;	// of the PDF
+	gint64	mtime;
+	guint32	page_count, reserved;
+	
+}	CacheHeader;
+
+typedef struct
+{
+	guint64	text, boxes;	// file offsets
+	guint32	text_len, chars;
+	
+}	CachePage;
+
+
+gpointer	Trigram( const char *str )
+{
+	return GUINT_TO_POINTER( (guchar)str[0] << 16 | (guchar)str[1] << 8 | (guchar)str[2] );
+}
+
+void	PostingFree( gpointer data )
+{
+	Posting	*posting = data;
+	
+	free( posting->pages );
+	free( posting );
+	return;
+}
+
+// lower case every character on its own, so characters and boxes stay in step
+char*	Green_IndexFold( const char *str )
+{
+	const char	*s;
+	char	*res, *tmp;
+	int	len = 0;
+	
+	if (!(res = malloc( strlen( str ) * 6 + 1 )))
+		return NULL;
+	
+	for (s = str; *s; s = g_utf8_next_char( s ))
+		len += g_unichar_to_utf8( g_unichar_tolower( g_utf8_get_char( s ) ), res + len );
+	
+	res[len] = 0;
+	tmp = realloc( res, len + 1 );
+	return tmp ? tmp : res;
+}
+
+guint16	BoxCoord( double value )
+{
+	value *= GREEN_BOX_UNIT;
+	return value < 0 ? 0 : value > 0xFFFF ? 0xFFFF : value;
+}
+
+bool	Green_IndexExtract( PopplerPage *page, Green_PageText *res )
+{
+	PopplerRectangle	*rects = NULL;
+	guint	i, n = 0;
+	glong	chars;
+	char	*text;
+	
+	res->text = NULL;
+	res->boxes = NULL;
+	if (!(text = poppler_page_get_text( page )))
+		return false;
+	
+	poppler_page_get_text_layout( page, &rects, &n );
+	chars = g_utf8_strlen( text, -1 );
+	if (chars > n)
+	{
+		// no box for the rest, drop it
+		*g_utf8_offset_to_pointer( text, n ) = 0;
+		chars = n;
+	}
+	
+	res->chars = chars;
+	res->text = Green_IndexFold( text );
+	res->boxes = malloc( (chars ? chars : 1) * sizeof( *res->boxes ) );
+	g_free( text );
+	if (!res->text || !res->boxes)
+	{
+		free( res->text );
+		free( res->boxes );
+		res->text = NULL;
+		res->boxes = NULL;
+		g_free( rects );
+		return false;
+	}
+	
+	for (i = 0; i < chars; i++)
+	{
+		res->boxes[i].x1 = BoxCoord( rects[i].x1 );
+		res->boxes[i].y1 = BoxCoord( rects[i].y1 );
+		res->boxes[i].x2 = BoxCoord( rects[i].x2 );
+		res->boxes[i].y2 = BoxCoord( rects[i].y2 );
+	}
+	
+	g_free( rects );
+	return true;
+}
+
+// pages are added in ascending order, so every posting list stays sorted
+void	IndexAddTrigrams( Green_TextIndex *idx, const char *text, int page_nr )
+{
+	Posting	*posting;
+	const char	*s;
+	int	*tmp;
+	
+	for (s = text; s[0] && s[1] && s[2]; s++)
+	{
+		posting = g_hash_table_lookup( idx->trigrams, Trigram( s ) );
+		if (!posting)
+		{
+			if (!(posting = calloc( 1, sizeof( *posting ) )))
+				continue;
+			
+			g_hash_table_insert( idx->trigrams, Trigram( s ), posting );
+		}
+		
+		if (posting->count && posting->pages[posting->count-1] == page_nr)
+			continue;
+		
+		if (posting->count == posting->size)
+		{
+			tmp = realloc( posting->pages, (posting->size ? posting->size * 2 : 4) * sizeof( *tmp ) );
+			if (!tmp)
+				continue;
+			
+			posting->pages = tmp;
+			posting->size = posting->size ? posting->size * 2 : 4;
+		}
+		
+		posting->pages[posting->count++] = page_nr;
+	}
+	
+	return;
+}
+
+// FNV-1a over the size and 17 evenly spread 4 KiB samples including both
+// ends of the file; tells files apart cheaply even if they are huge
+bool	Green_FileHash( int fd, guint64 size, guint64 *res )
+{
+	unsigned char	buf[4096];
+	guint64	hash = 14695981039346656037ULL, pos;
+	ssize_t	i, n;
+	int	j;
+	
+	for (j = 0; j < 8; j++)
+		hash = (hash ^ ((size >> (j * 8)) & 0xFF)) * 1099511628211ULL;
+	
+	for (j = 0; j <= 16; j++)
+	{
+		pos = size > sizeof( buf ) ? (size - sizeof( buf )) / 16 * j : 0;
+		if ((n = pread( fd, buf, sizeof( buf ), pos )) < 0)
+			return false;
+		
+		for (i = 0; i < n; i++)
+			hash = (hash ^ buf[i]) * 1099511628211ULL;
+	}
+	
+	*res = hash;
+	return true;
+}
+
+// returns the path of the text cache of doc in the directory of the index,
+// NULL if the document is no local file or nothing is cached on disk
+char*	CachePath( Green_Document *doc, struct stat *st, guint64 *hash )
+{
+	Green_DiskCache	*disk = doc->index.disk;
+	char	*filename, *name, *res = NULL;
+	int	fd;
+	
+	if (!disk || !disk->dir || !disk->limit || !(filename = g_filename_from_uri( doc->uri, NULL, NULL )))
+		return NULL;
+	
+	fd = open( filename, O_RDONLY );
+	g_free( filename );
+	if (fd < 0)
+		return NULL;
+	
+	if (!fstat( fd, st ) && Green_FileHash( fd, st->st_size, hash ))
+	{
+		name = g_strdup_printf( "%016llx", (unsigned long long)*hash );
+		res = g_build_filename( disk->dir, name, NULL );
+		g_free( name );
+	}
+	
+	close( fd );
+	return res;
+}
+
+// map the cache file and let the pages point into it; nothing is published
+// unless the whole file is consistent with the document
+bool	CacheLoad( Green_Document *doc, const char *path, struct stat *st, guint64 hash )
+{
+	Green_TextIndex	*idx = &doc->index;
+	CacheHeader	*header;
+	CachePage	*table;
+	struct stat	cst;
+	char	*map;
+	int	i, fd;
+	
+	if ((fd = open( path, O_RDONLY )) < 0)
+		return false;
+	
+	if (fstat( fd, &cst ) || (size_t)cst.st_size < sizeof( *header ))
+	{
+		close( fd );
+		return false;
+	}
+	
+	map = mmap( NULL, cst.st_size, PROT_READ, MAP_PRIVATE, fd, 0 );
+	close( fd );
+	if (map == MAP_FAILED)
+		return false;
+	
+	header = (CacheHeader*)map;
+	table = (CachePage*)(header + 1);
+	if (memcmp( header->magic, CACHE_MAGIC, 8 ) || header->size != (guint64)st->st_size
+		|| header->mtime != (gint64)st->st_mtime || header->hash != hash
+		|| header->page_count != (guint32)doc->page_count
+		|| sizeof( *header ) + (guint64)doc->page_count * sizeof( *table ) > (guint64)cst.st_size)
+	{
+		munmap( map, cst.st_size );
+		return false;
+	}
+	
+	// the search walks the text as UTF-8 with a box for every character
+	for (i = 0; i < doc->page_count; i++)
+		if (table[i].text >= (guint64)cst.st_size || table[i].text_len >= (guint64)cst.st_size - table[i].text
+			|| map[table[i].text + table[i].text_len]
+			|| !g_utf8_validate( map + table[i].text, table[i].text_len, NULL )
+			|| g_utf8_strlen( map + table[i].text, table[i].text_len ) != (glong)table[i].chars
+			|| table[i].boxes % 8 || table[i].boxes > (guint64)cst.st_size
+			|| (guint64)table[i].chars * sizeof( Green_CharBox ) > (guint64)cst.st_size - table[i].boxes)
+		{
+			munmap( map, cst.st_size );
+			return false;
+		}
+	
+	idx->map = map;
+	idx->map_size = cst.st_size;
+	for (i = 0; i < doc->page_count && !g_atomic_int_get( &idx->quit ); i++)
+	{
+		idx->pages[i].text = map + table[i].text;
+		idx->pages[i].boxes = (Green_CharBox*)(map + table[i].boxes);
+		idx->pages[i].chars = table[i].chars;
+		g_mutex_lock( &idx->lock );
+		IndexAddTrigrams( idx, idx->pages[i].text, i );
+		g_mutex_unlock( &idx->lock );
+		g_atomic_int_set( &idx->done, i + 1 );
+	}
+	
+	return true;
+}
+
+// write to a temporary file first, so readers never see half a cache; it is
+// hidden, so pruning the directory leaves it alone
+void	CacheWrite( Green_Document *doc, const char *path, struct stat *st, guint64 hash )
+{
+	Green_PageText	*pt;
+	CacheHeader	header;
+	CachePage	page;
+	guint64	offset, pos;
+	size_t	len, chars;
+	char	*dir, *base, *tmp, zero[8] = {0};
+	FILE	*file;
+	bool	ok;
+	int	i;
+	
+	dir = g_path_get_dirname( path );
+	base = g_path_get_basename( path );
+	g_mkdir_with_parents( dir, 0700 );
+	tmp = g_strdup_printf( "%s/.%s.%d", dir, base, (int)getpid() );
+	g_free( dir );
+	g_free( base );
+	if (!(file = fopen( tmp, "wb" )))
+	{
+		g_free( tmp );
+		return;
+	}
+	
+	memset( &header, 0, sizeof( header ) );
+	memcpy( header.magic, CACHE_MAGIC, 8 );
+	header.size = st->st_size;
+	header.mtime = st->st_mtime;
+	header.hash = hash;
+	header.page_count = doc->page_count;
+	ok = fwrite( &header, sizeof( header ), 1, file ) == 1;
+	offset = sizeof( header ) + (guint64)doc->page_count * sizeof( page );
+	for (i = 0; i < doc->page_count && ok; i++)
+	{
+		pt = &doc->index.pages[i];
+		memset( &page, 0, sizeof( page ) );
+		page.text = offset;
+		page.text_len = pt->text ? strlen( pt->text ) : 0;
+		page.chars = pt->text ? pt->chars : 0;
+		page.boxes = CACHE_ALIGN( page.text + page.text_len + 1 );
+		offset = CACHE_ALIGN( page.boxes + (guint64)page.chars * sizeof( Green_CharBox ) );
+		ok = fwrite( &page, sizeof( page ), 1, file ) == 1;
+	}
+	
+	pos = offset = sizeof( header ) + (guint64)doc->page_count * sizeof( page );
+	for (i = 0; i < doc->page_count && ok; i++)
+	{
+		pt = &doc->index.pages[i];
+		len = pt->text ? strlen( pt->text ) : 0;
+		chars = pt->text ? pt->chars : 0;
+		ok = fwrite( pt->text ? pt->text : "", 1, len + 1, file ) == len + 1;
+		pos = CACHE_ALIGN( offset + len + 1 );
+		ok = ok && fwrite( zero, 1, pos - offset - len - 1, file ) == pos - offset - len - 1;
+		ok = ok && fwrite( pt->boxes, sizeof( Green_CharBox ), chars, file ) == chars;
+		offset = pos + chars * sizeof( Green_CharBox );
+		pos = CACHE_ALIGN( offset );
+		ok = ok && fwrite( zero, 1, pos - offset, file ) == pos - offset;
+		offset = pos;
+	}
+	
+	if (fclose( file ) || !ok || rename( tmp, path ))
+		unlink( tmp );
+	else
+		Green_DiskAccount( doc->index.disk, offset );
+	
+	g_free( tmp );
+	return;
+}
+
+gpointer	IndexThread( gpointer data )
+{
+	Green_Document	*doc = data;
+	Green_TextIndex	*idx = &doc->index;
+	PopplerDocument	*pdoc;
+	PopplerPage	*page;
+	struct stat	st;
+	guint64	hash;
+	char	*path;
+	int	i;
+	
+	path = CachePath( doc, &st, &hash );
+	if (path && CacheLoad( doc, path, &st, hash ))
+	{
+		g_free( path );
+		return NULL;
+	}
+	
+	if (!(pdoc = Green_AcquireDocument( doc )))
+	{
+		g_free( path );
+		return NULL;
+	}
+	
+	for (i = 0; i < doc->page_count && !g_atomic_int_get( &idx->quit ); i++)
+	{
+		if (idx->seed && idx->seed[i].text)
+		{
+			idx->pages[i] = idx->seed[i];
+			idx->seed[i].text = NULL;
+			idx->seed[i].boxes = NULL;
+		}
+		else
+		{
+			page = poppler_document_get_page( pdoc, i );
+			Green_IndexExtract( page, &idx->pages[i] );
+			g_object_unref( G_OBJECT( page ) );
+		}
+		
+		if (idx->pages[i].text)
+		{
+			g_mutex_lock( &idx->lock );
+			IndexAddTrigrams( idx, idx->pages[i].text, i );
+			g_mutex_unlock( &idx->lock );
+		}
+		
+		// publishes pages[i] to the readers
+		g_atomic_int_set( &idx->done, i + 1 );
+	}
+	
+	Green_ReleaseDocument( doc, pdoc );
+	if (path && i == doc->page_count)
+		CacheWrite( doc, path, &st, hash );
+	
+	g_free( path );
+	return NULL;
+}
+
+// the cache files of the text live in disk; without build the index stays
+// empty and searches ask poppler until Green_IndexBuild is called
+void	Green_IndexStart( Green_Document *doc, Green_DiskCache *disk, bool build )
+{
+	Green_TextIndex	*idx = &doc->index;
+	
+	idx->disk = disk;
+	idx->thread = NULL;
+	idx->done = 0;
+	idx->quit = 0;
+	idx->map = NULL;
+	idx->map_size = 0;
+	idx->seed = NULL;
+	g_mutex_init( &idx->lock );
+	idx->trigrams = g_hash_table_new_full( g_direct_hash, g_direct_equal, NULL, PostingFree );
+	idx->pages = calloc( doc->page_count ? doc->page_count : 1, sizeof( *idx->pages ) );
+	if (build)
+		Green_IndexBuild( doc, NULL );
+	
+	return;
+}
+
+// start indexing a document whose index was started without building it;
+// takes over seed, the text of the pages already extracted, NULL if none
+void	Green_IndexBuild( Green_Document *doc, Green_PageText *seed )
+{
+	Green_TextIndex	*idx = &doc->index;
+	
+	idx->seed = seed;
+	if (idx->pages && !idx->thread)
+		idx->thread = g_thread_try_new( "index", IndexThread, doc, NULL );
+	
+	return;
+}
+
+void	Green_IndexStop( Green_Document *doc )
+{
+	Green_TextIndex	*idx = &doc->index;
+	int	i;
+	
+	if (idx->thread)
+	{
+		g_atomic_int_set( &idx->quit, 1 );
+		g_thread_join( idx->thread );
+	}
+	
+	if (idx->map)
+		munmap( idx->map, idx->map_size );
+	else if (idx->pages)
+		for (i = 0; i < g_atomic_int_get( &idx->done ); i++)
+		{
+			free( idx->pages[i].text );
+			free( idx->pages[i].boxes );
+		}
+	
+	// what the thread did not take over
+	for (i = 0; idx->seed && i < doc->page_count; i++)
+	{
+		free( idx->seed[i].text );
+		free( idx->seed[i].boxes );
+	}
+	
+	free( idx->seed );
+	free( idx->pages );
+	g_hash_table_destroy( idx->trigrams );
+	g_mutex_clear( &idx->lock );
+	idx->thread = NULL;
+	idx->pages = NULL;
+	return;
+}
+
+// number of pages from the first on that searches can be answered for
+int	Green_IndexProgress( Green_TextIndex *idx )
+{
+	return idx->thread ? g_atomic_int_get( &idx->done ) : 0;
+}
+
+// first page in [from, to) containing the folded query; to must not exceed the progress
+int	Green_IndexFind( Green_TextIndex *idx, const char *query, int from, int to )
+{
+	Posting	*posting, *rarest = NULL;
+	const char	*s;
+	int	i, lo, hi, res = -1;
+	
+	if (strlen( query ) < 3)
+	{
+		for (i = from; i < to; i++)
+			if (idx->pages[i].text && strstr( idx->pages[i].text, query ))
+				return i;
+		
+		return -1;
+	}
+	
+	// only the pages listed for the rarest trigram of the query can contain it
+	g_mutex_lock( &idx->lock );
+	for (s = query; s[2]; s++)
+	{
+		posting = g_hash_table_lookup( idx->trigrams, Trigram( s ) );
+		if (!rarest || !posting || posting->count < rarest->count)
+			rarest = posting;
+		
+		if (!rarest)
+			break;
+	}
+	
+	if (rarest)
+	{
+		for (lo = 0, hi = rarest->count; lo < hi; )
+			if (rarest->pages[(lo + hi) / 2] < from)
+				lo = (lo + hi) / 2 + 1;
+			else
+				hi = (lo + hi) / 2;
+		
+		for (i = lo; i < rarest->count && rarest->pages[i] < to; i++)
+			if (strstr( idx->pages[rarest->pages[i]].text, query ))
+			{
+				res = rarest->pages[i];
+				break;
+			}
+	}
+	
+	g_mutex_unlock( &idx->lock );
+	return res;
+}
+
+// stores the hits of the folded query on an indexed page in *res, one rectangle
+// per line a hit spans; returns their number or -1 if out of memory
+int	Green_IndexHits( Green_TextIndex *idx, int page_nr, const char *query, PopplerRectangle **res )
+{
+	Green_PageText	*pt = &idx->pages[page_nr];
+	PopplerRectangle	*rects = NULL, *tmp, *r = NULL;
+	Green_CharBox	*box;
+	const char	*s, *prev = pt->text;
+	glong	i, first = 0, len = g_utf8_strlen( query, -1 );
+	int	count = 0, size = 0;
+	
+	*res = NULL;
+	if (!pt->text)
+		return 0;
+	
+	for (s = strstr( pt->text, query ); s; s = strstr( s + strlen( query ), query ))
+	{
+		first += g_utf8_pointer_to_offset( prev, s );
+		prev = s;
+		for (i = first; i < first + len && i < pt->chars; i++)
+		{
+			box = &pt->boxes[i];
+			if (r && i > first && box->y1 < r->y2 * GREEN_BOX_UNIT && box->y2 > r->y1 * GREEN_BOX_UNIT)
+			{
+				r->x1 = MIN( r->x1, (double)box->x1 / GREEN_BOX_UNIT );
+				r->y1 = MIN( r->y1, (double)box->y1 / GREEN_BOX_UNIT );
+				r->x2 = MAX( r->x2, (double)box->x2 / GREEN_BOX_UNIT );
+				r->y2 = MAX( r->y2, (double)box->y2 / GREEN_BOX_UNIT );
+				continue;
+			}
+			
+			// first character of the hit or of a new line
+			if (count == size)
+			{
+				if (!(tmp = realloc( rects, (size ? size * 2 : 8) * sizeof( *tmp ) )))
+				{
+					free( rects );
+					return -1;
+				}
+				
+				rects = tmp;
+				size = size ? size * 2 : 8;
+			}
+			
+			r = &rects[count++];
+			r->x1 = (double)box->x1 / GREEN_BOX_UNIT;
+			r->y1 = (double)box->y1 / GREEN_BOX_UNIT;
+			r->x2 = (double)box->x2 / GREEN_BOX_UNIT;
+			r->y2 = (double)box->y2 / GREEN_BOX_UNIT;
+		}
+	}
+	
+	*res = rects;
+	return count;
+}
@@ -18,6 +18,9 @@
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
+#include <ctype.h>
+#include <errno.h>
+#include <stdint.h>
 #include "green.h"
 
 
@@ -30,6 +33,13 @@
 #define SCHEME_HIGHLIGHTCOLOR		 7
 #define SCHEME_HIGHLIGHTALPHA		 8
 #define SCHEME_CURSORBORDER		 9
+#define SCHEME_CACHESIZE		10
+#define SCHEME_CONTINUOUS		11
+#define SCHEME_CONTINUOUSGAP		12
+#define SCHEME_CACHEDIRECTORY		13
+#define SCHEME_CACHEDIRECTORYSIZE	14
+#define SCHEME_MEMORYLIMIT		15
+#define SCHEME_RELOAD			16
 
 #define RGB_TEXT "/usr/share/X11/rgb.txt"
 
@@ -67,12 +77,20 @@ struct SchemeProperty	scheme_property[] =
 	{"Cursor.Border", SCHEME_CURSORBORDER, 0},
 	{"Background.Color", SCHEME_BACKGROUNDCOLOR, 0},
 	{"Highlight.Color", SCHEME_HIGHLIGHTCOLOR, 0},
-	{"Highlight.Alpha", SCHEME_HIGHLIGHTALPHA, 0}
+	{"Highlight.Alpha", SCHEME_HIGHLIGHTALPHA, 0},
+	{"Cache.Size", SCHEME_CACHESIZE, 0},
+	{"Continuous", SCHEME_CONTINUOUS, 0},
+	{"Continuous.Gap", SCHEME_CONTINUOUSGAP, 0},
+	{"Cache.Directory", SCHEME_CACHEDIRECTORY, 0},
+	{"Cache.Directory.Size", SCHEME_CACHEDIRECTORYSIZE, 0},
+	{"Memory.Limit", SCHEME_MEMORYLIMIT, 0},
+	{"Reload", SCHEME_RELOAD, 0}
 };
 
 const char	*help_text =
 "Usage:\n"
 "    green [<options>] <PDF file 1> [<PDF file 2> [...]]\n"
+"    A PDF file of - is read from stdin.\n"
 "\n"
 "The following options are available:\n"
 "    -config=<filename>          to read a configuration from a non-standard path\n"
@@ -81,6 +99,17 @@ const char	*help_text =
 "    -no-fullscreen              to startup in window mode\n"
 "    -width=<width>              to specify the window width (in pixels)\n"
 "    -height=<height>            to specify the window height (in pixels)\n"
+"    -continuous                 to show the pages below each other\n"
+"    -no-continuous              to show one page at a time\n"
+"    -gap=<pixels>               to specify the space between pages in continuous mode\n"
+"    -reload                     to reload documents when their files change\n"
+"    -no-reload                  to keep documents as they were opened\n"
+"    -export=<directory>         to render the pages to PNG files without a display\n"
+"    -pages=<ranges>             to export only some pages, like 1-3,7,10-\n"
+"    -scale=<factor>             to scale exported pages after fitting them\n"
+"    -rotate=<quarter turns>     to export pages rotated right\n"
+"    -mirror                     to export pages mirrored horizontally\n"
+"    -ppm                        to export PPM instead of PNG files\n"
 "    -help                       shows this help\n"
 "    -version                    displays version information\n"
 "\n"
@@ -122,6 +151,34 @@ double	ReadFraction( char *str )
 	return res;
 }
 
+int	ReadSize( char *str, size_t *size )
+{
+	unsigned long long	res;
+	char	*str2;
+	int	shift = 0;
+	
+	if (*str < '0' || *str > '9')
+		return -1;
+	
+	errno = 0;
+	res = strtoull( str, &str2, 10 );
+	if (*str2 == 'k' || *str2 == 'K')
+		shift = 10;
+	else if (*str2 == 'm' || *str2 == 'M')
+		shift = 20;
+	else if (*str2 == 'g' || *str2 == 'G')
+		shift = 30;
+	else if (*str2)
+		return -1;
+	
+	// a size that does not fit would wrap to a small one
+	if ((*str2 && str2[1]) || errno == ERANGE || res > SIZE_MAX >> shift)
+		return -1;
+	
+	*size = res << shift;
+	return 0;
+}
+
 char*	ScanIdentifier( char **ptr )
 {
 	char	*start = *ptr, *id;
@@ -142,71 +199,135 @@ char*	ScanIdentifier( char **ptr )
 	return id;
 }
 
-int	ReadLine( FILE *f, char *buffer, int len )
-{
-	char c = '\0';
-	int i = 0;
-
-	if (len <= 1)
-		return 1;
-
-	unsigned int cnt = fread( &c, 1, 1, f );
-
-	while (c != '\n' && c != '\r') {
-		if (cnt != 1) {
-			if (feof( f )) {
-				buffer[i] = 0;
-				return 1;
-			}
-			else {
-				printf( "Read file failed" );
-				exit( 1 );
-			}
-		}
-
-		buffer[i++] = c;
+// colours by lower case name, made on first use; the built-in names come first
+// and are not overridden by those of rgb.txt, which is only read once a name
+// is not among them
+GHashTable	*color_table = NULL;
+bool	color_loaded = false;	// are the names of rgb.txt in color_table?
 
-		if (--len == 1)
-			break;
+const struct
+{
+	const char	*name;
+	unsigned char	r, g, b;
+	
+}	color_builtin[] =
+{
+	{"black", 0x00, 0x00, 0x00},
+	{"gray", 0x80, 0x80, 0x80},
+	{"maroon", 0x80, 0x00, 0x00},
+	{"red", 0xFF, 0x00, 0x00},
+	{"green", 0x00, 0x80, 0x00},
+	{"lime", 0x00, 0xFF, 0x00},
+	{"olive", 0x80, 0x80, 0x00},
+	{"yellow", 0xFF, 0xFF, 0x00},
+	{"navy", 0x00, 0x00, 0x80},
+	{"blue", 0x00, 0x00, 0xFF},
+	{"purple", 0x80, 0x00, 0x80},
+	{"fuchsia", 0xFF, 0x00, 0xFF},
+	{"teal", 0x00, 0x80, 0x80},
+	{"aqua", 0x00, 0xFF, 0xFF},
+	{"silver", 0xC0, 0xC0, 0xC0},
+	{"white", 0xFF, 0xFF, 0xFF}
+};
 
-		cnt = fread( &c, 1, 1, f );
-	}
 
-	buffer[i] = 0;
-	return 0;
+void	ColorInsert( const char *name, int r, int g, int b )
+{
+	char	*key = strdup( name ), *c;
+	
+	if (!key)
+		return;
+	
+	for (c = key; *c; c++)
+		*c = tolower( (unsigned char)*c );
+	
+	// earlier names win; the flag keeps black apart from a missing name
+	if (g_hash_table_lookup( color_table, key ))
+		free( key );
+	else
+		g_hash_table_insert( color_table, key, GUINT_TO_POINTER( 0x01000000 | r << 16 | g << 8 | b ) );
+	
+	return;
 }
 
-int	TryX11RGBText( Green_RGBA *color, char *str )
+void	ColorBuiltin( void )
 {
-	if (str == NULL)
-		return 1;
+	int	i;
+	
+	color_table = g_hash_table_new_full( g_str_hash, g_str_equal, free, NULL );
+	for (i = 0; i < sizeof( color_builtin ) / sizeof( color_builtin[0] ); i++)
+		ColorInsert( color_builtin[i].name, color_builtin[i].r, color_builtin[i].g, color_builtin[i].b );
+	
+	return;
+}
 
-	FILE *file = fopen( RGB_TEXT, "r" );
-	if (!file)
+// rgb.txt has lines like "255 250 250\t\tsnow", names may contain spaces
+void	ColorLoad( void )
+{
+	FILE	*file;
+	char	buf[256], *name, *end;
+	int	r, g, b, n;
+	
+	color_loaded = true;
+	if (!(file = fopen( RGB_TEXT, "r" )))
+		return;
+	
+	while (fgets( buf, sizeof( buf ), file ))
 	{
-		return 1;
+		if (sscanf( buf, "%d %d %d %n", &r, &g, &b, &n ) < 3
+			|| r < 0 || r > 0xFF || g < 0 || g > 0xFF || b < 0 || b > 0xFF)
+			continue;
+		
+		name = buf + n;
+		for (end = name + strlen( name ); end > name && isspace( (unsigned char)end[-1] ); end--);
+		*end = 0;
+		if (*name)
+			ColorInsert( name, r, g, b );
 	}
+	
+	fclose( file );
+	return;
+}
 
-	char buf[256];
-	while (!ReadLine( file, buf, 255 ))
-	{
-		if (!strcasecmp( str, buf+13 ))
-		{
-
-#define GetDigit( d ) \
-	(d == ' ' ? 0 : d - '0')
+void	ColorFree( void )
+{
+	if (color_table)
+		g_hash_table_destroy( color_table );
+	
+	color_table = NULL;
+	color_loaded = false;
+	return;
+}
 
-			color->r = (GetDigit( buf[0] )*10 + GetDigit( buf[1] ))*10 + GetDigit( buf[ 2] );
-			color->g = (GetDigit( buf[4] )*10 + GetDigit( buf[5] ))*10 + GetDigit( buf[ 6] );
-			color->b = (GetDigit( buf[8] )*10 + GetDigit( buf[9] ))*10 + GetDigit( buf[10] );
-			fclose( file );
-			return 0;
-		}
+int	LookupColor( Green_RGBA *color, char *str )
+{
+	char	key[256];
+	guint	rgb;
+	int	i;
+	
+	if (!color_table)
+		ColorBuiltin();
+	
+	for (i = 0; str[i] && i < sizeof( key ) - 1; i++)
+		key[i] = tolower( (unsigned char)str[i] );
+	
+	key[i] = 0;
+	if (str[i])
+		return -1;
+	
+	if (!(rgb = GPOINTER_TO_UINT( g_hash_table_lookup( color_table, key ) )) && !color_loaded)
+	{
+		ColorLoad();
+		rgb = GPOINTER_TO_UINT( g_hash_table_lookup( color_table, key ) );
 	}
-
-	fclose( file );
-
-	return 1;
+	
+	if (!rgb)
+		return -1;
+	
+	color->r = rgb >> 16 & 0xFF;
+	color->g = rgb >> 8 & 0xFF;
+	color->b = rgb & 0xFF;
+	return 0;
 }
 
 int	GetColor( Green_RGBA *color, char *str )
@@ -246,105 +367,8 @@ int	GetColor( Green_RGBA *color, char *str )
 		color->g = tmp.g;
 		color->b = tmp.b;
 	}
-	else if (!strcasecmp( str, "black" ))
-	{
-		color->r = 0x00;
-		color->g = 0x00;
-		color->b = 0x00;
-	}
-	else if (!strcasecmp( str, "gray" ))
-	{
-		color->r = 0x80;
-		color->g = 0x80;
-		color->b = 0x80;
-	}
-	else if (!strcasecmp( str, "maroon" ))
-	{
-		color->r = 0x80;
-		color->g = 0x00;
-		color->b = 0x00;
-	}
-	else if (!strcasecmp( str, "red" ))
-	{
-		color->r = 0xFF;
-		color->g = 0x00;
-		color->b = 0x00;
-	}
-	else if (!strcasecmp( str, "green" ))
-	{
-		color->r = 0x00;
-		color->g = 0x80;
-		color->b = 0x00;
-	}
-	else if (!strcasecmp( str, "lime" ))
-	{
-		color->r = 0x00;
-		color->g = 0xFF;
-		color->b = 0x00;
-	}
-	else if (!strcasecmp( str, "olive" ))
-	{
-		color->r = 0x80;
-		color->g = 0x80;
-		color->b = 0x00;
-	}
-	else if (!strcasecmp( str, "yellow" ))
-	{
-		color->r = 0xFF;
-		color->g = 0xFF;
-		color->b = 0x00;
-	}
-	else if (!strcasecmp( str, "navy" ))
-	{
-		color->r = 0x00;
-		color->g = 0x00;
-		color->b = 0x80;
-	}
-	else if (!strcasecmp( str, "blue" ))
-	{
-		color->r = 0x00;
-		color->g = 0x00;
-		color->b = 0xFF;
-	}
-	else if (!strcasecmp( str, "purple" ))
-	{
-		color->r = 0x80;
-		color->g = 0x00;
-		color->b = 0x80;
-	}
-	else if (!strcasecmp( str, "fuchsia" ))
-	{
-		color->r = 0xFF;
-		color->g = 0x00;
-		color->b = 0xFF;
-	}
-	else if (!strcasecmp( str, "teal" ))
-	{
-		color->r = 0x00;
-		color->g = 0x80;
-		color->b = 0x80;
-	}
-	else if (!strcasecmp( str, "aqua" ))
-	{
-		color->r = 0x00;
-		color->g = 0xFF;
-		color->b = 0xFF;
-	}
-	else if (!strcasecmp( str, "silver" ))
-	{
-		color->r = 0xC0;
-		color->g = 0xC0;
-		color->b = 0xC0;
-	}
-	else if (!strcasecmp( str, "white" ))
-	{
-		color->r = 0xFF;
-		color->g = 0xFF;
-		color->b = 0xFF;
-	}
-	else
-		if (TryX11RGBText( color, str ))
-			return -1;
+	else if (LookupColor( color, str ))
+		return -1;
 	
 	return 0;
 }
@@ -472,6 +496,47 @@ int	EvalProperty( Green_RTD *rtd, int id, char *arg )
 			else
 				res = -1;
 			
+			break;
+		case SCHEME_CACHESIZE:
+			res = ReadSize( arg, &rtd->cache_limit );
+			break;
+		case SCHEME_CONTINUOUS:
+			if (!strcasecmp( arg, "yes" ))
+				rtd->flags |= GREEN_CONTINUOUS;
+			else if (!strcasecmp( arg, "no" ))
+				rtd->flags &= ~GREEN_CONTINUOUS;
+			else
+				res = -1;
+			
+			break;
+		case SCHEME_CONTINUOUSGAP:
+			tmpl = strtol( arg, &tmpc, 10 );
+			if (*tmpc || tmpl < 0)
+				res = -1;
+			else
+				rtd->gap = tmpl;
+			
+			break;
+		case SCHEME_CACHEDIRECTORY:
+			free( rtd->disk.dir );
+			if (!(rtd->disk.dir = strdup( arg )))
+				res = -1;
+			
+			break;
+		case SCHEME_CACHEDIRECTORYSIZE:
+			res = ReadSize( arg, &rtd->disk.limit );
+			break;
+		case SCHEME_MEMORYLIMIT:
+			res = ReadSize( arg, &rtd->memory_limit );
+			break;
+		case SCHEME_RELOAD:
+			if (!strcasecmp( arg, "yes" ))
+				rtd->flags |= GREEN_RELOAD;
+			else if (!strcasecmp( arg, "no" ))
+				rtd->flags &= ~GREEN_RELOAD;
+			else
+				res = -1;
+			
 			break;
 	}
 	
@@ -885,6 +950,7 @@ int	ParseConfig( char *filename, struct SchemeArray *schemes, char **default_sch
 int	main( int argc, char *argv[] )
 {
 	Green_RTD	rtd;
+	Green_Export	export;
 	struct SchemeArray	schemes;
 	char	*opt, *config_file = NULL, *default_scheme = NULL, *current_scheme = NULL;
 	int i, err = 0;
@@ -907,6 +973,17 @@ int	main( int argc, char *argv[] )
 	rtd.step = 1;
 	rtd.zoomstep = 1.1;
 	rtd.bb = 0x04;
+	rtd.cache_limit = 32 << 20;
+	rtd.memory_limit = 0;
+	rtd.gap = 8;
+	Green_DiskInit( &rtd.disk );
+	rtd.disk.limit = 256 << 20;
+	Green_DiskInit( &rtd.text );
+	rtd.watch_fd = -1;
+	Green_PrefetchInit( &rtd.prefetch );
+	Green_SearchInit( &rtd.search );
+	Green_LoaderInit( &rtd.loader );
+	Green_ExportInit( &export );
 	rtd.mouse.flags = 1;
 	rtd.mouse.visibility = 500;
 	rtd.mouse.border_size = 0;
@@ -917,7 +994,7 @@ int	main( int argc, char *argv[] )
 	
 	for (i = 1; i < argc; i++)
 	{
-		if (argv[i][0] != '-')
+		if (argv[i][0] != '-' || !argv[i][1])
 			continue;
 		
 		opt = argv[i][1] == '-' ? &argv[i][2] : &argv[i][1];
@@ -997,13 +1074,15 @@ int	main( int argc, char *argv[] )
 	
 	if (current_scheme)
 	{
-		if ((err = ProcessSchemes( &rtd, &schemes, current_scheme )))
+		err = ProcessSchemes( &rtd, &schemes, current_scheme );
+		ColorFree();
+		if (err)
 			return err;
 	}
 	
 	for (i = 1; i < argc; i++)
 	{
-		if (argv[i][0] != '-')
+		if (argv[i][0] != '-' || !argv[i][1])
 			continue;
 		
 		opt = argv[i][1] == '-' ? &argv[i][2] : &argv[i][1];
@@ -1068,6 +1147,49 @@ int	main( int argc, char *argv[] )
 			rtd.flags |= GREEN_FULLSCREEN;
 		else if (!strcmp( opt, "no-fullscreen" ))
 			rtd.flags &= ~GREEN_FULLSCREEN;
+		else if (!strcmp( opt, "continuous" ))
+			rtd.flags |= GREEN_CONTINUOUS;
+		else if (!strcmp( opt, "no-continuous" ))
+			rtd.flags &= ~GREEN_CONTINUOUS;
+		else if (!strcmp( opt, "reload" ))
+			rtd.flags |= GREEN_RELOAD;
+		else if (!strcmp( opt, "no-reload" ))
+			rtd.flags &= ~GREEN_RELOAD;
+		else if (!strncmp( opt, "gap=", 4 ))
+		{
+			opt += 4;
+			rtd.gap = strtol( opt, &opt, 10 );
+			if (*opt || rtd.gap < 0)
+				err = -1;
+		}
+		else if (!strncmp( opt, "export=", 7 ))
+		{
+			export.dir = opt + 7;
+			if (!*export.dir)
+				err = -1;
+		}
+		else if (!strncmp( opt, "pages=", 6 ))
+			export.pages = opt + 6;
+		else if (!strncmp( opt, "scale=", 6 ))
+		{
+			opt += 6;
+			export.scale = strtod( opt, &opt );
+			if (*opt || export.scale <= 0)
+				err = -1;
+		}
+		else if (!strncmp( opt, "rotate=", 7 ))
+		{
+			opt += 7;
+			export.rotation = strtol( opt, &opt, 10 );
+			if (*opt || export.rotation < 0)
+				err = -1;
+			
+			export.rotation %= 4;
+		}
+		else if (!strcmp( opt, "mirror" ))
+			export.mirrored = true;
+		else if (!strcmp( opt, "ppm" ))
+			export.ppm = true;
 		else
 			err = -1;
 		
@@ -1079,17 +1201,53 @@ int	main( int argc, char *argv[] )
 		}
 	}
 	
+	Green_CacheSetBudget( rtd.memory_limit );
+	if (export.dir)
+	{
+		if (rtd.fit_method != NATURAL && (!rtd.width || !rtd.height))
+		{
+			fprintf( stderr, "Fitting exported pages needs -width and -height!\n" );
+			return -1;
+		}
+		
+		rtd.flags |= GREEN_HEADLESS;
+		for (i = 1; i < argc; i++)
+			if ((argv[i][0] != '-' || !argv[i][1]) && Green_ExportDocument( &rtd, &export, argv[i] ))
+				err = 1;
+		
+		Green_ExportSummary( &export );
+		return err;
+	}
+	
+	// the text caches are bound like the tiles
+	rtd.text.dir = g_build_filename( g_get_user_cache_dir(), "green", NULL );
+	rtd.text.limit = rtd.disk.limit;
+	
+	// watched files are read into memory, others are mapped if they cannot change
+	if (rtd.flags & GREEN_RELOAD)
+		Green_WatchInit( &rtd );
+	
 	for (i = 1; i < argc; i++)
 	{
-		if (argv[i][0] == '-')
+		// a lone "-" is stdin
+		if (argv[i][0] == '-' && argv[i][1])
 			continue;
 		
-		if (Green_Open( &rtd, argv[i] ) < 0)
+		if (Green_OpenLater( &rtd, argv[i] ) < 0)
 		{
 			fprintf( stderr, "Failed to open: %s\n", argv[i] );
 			continue;
 		}
 	}
 	
-	return Green_SDL_Main( &rtd );
+	err = Green_SDL_Main( &rtd );
+	Green_LoaderStop( &rtd );
+	Green_WatchStop( &rtd );
+	Green_PrefetchStop( &rtd.prefetch );
+	Green_SearchStop( &rtd.search );
+	Green_DiskStop( &rtd.disk );
+	Green_DiskStop( &rtd.text );
+	free( rtd.disk.dir );
+	g_free( rtd.text.dir );
+	return err;
 }
@@ -17,11 +17,20 @@
 #include <stdlib.h>
 #include <SDL.h>
 #include "green.h"
+#include "blit.h"
 
 
 #define FLAG_QUIT	0x0001
 #define FLAG_RENDER	0x0002
 
+// codes of SDL_USEREVENT
+#define EVENT_LIVE	0	// the live timer ticked
+#define EVENT_RENDERED	1	// the worker finished a draft or the visible region, data1 is the generation
+#define EVENT_SEARCHED	2	// a background search finished, data1 is its generation
+#define EVENT_SETTLED	3	// no zoom or resize for settle_delay, data1 is the settle generation
+#define EVENT_THUMBS	4	// a thumbnail on the screen was made
+#define EVENT_OPENED	5	// a document given at startup was opened or failed
+
 
 typedef enum
 {
@@ -36,8 +45,65 @@ typedef struct
 	
 }	IBuffer;
 
+// what is currently on the screen, so a pure scroll can reuse it
+typedef struct
+{
+	SDL_Surface	*display;
+	Green_Document	*doc;	// NULL if the screen has to be redrawn completely
+	char	*search_str;
+	int	page, rotation, xoffset, yoffset;
+	bool	mirrored;
+	double	tscale;
+	SDL_Rect	rect;
+	bool	draft;	// only a preview is shown, the worker renders the real thing
+	bool	strips;	// the draft is a scrolled frame with blank strips
+	double	crisp;	// scale of the last finished frame of this view, 0 if none
+	bool	continuous;
+	int	pos;	// top of the display in the continuous layout
+	
+}	Frame;
+
+// the thumbnail grid shown instead of the page
+typedef struct
+{
+	bool	active;
+	int	top;	// first page of the top row
+	int	page;	// current page when the overview was opened
+	
+}	Overview;
+
 
 const Uint32	live_interval = 40;
+const Uint32	frame_interval = 16;	// least ms between two presented frames
+const Uint32	settle_delay = 200;	// ms without zoom or resize before the worker renders
+const int	thumb_margin = 16;	// space around a thumbnail in the overview
+Frame	presented = {NULL, NULL};
+Overview	overview = {false, 0, 0};
+unsigned int	render_generation = 0;	// of the last request for the worker to render the visible region
+SDL_TimerID	settle_timer = NULL;	// running while zoom or resize input keeps coming
+unsigned int	settle_generation = 0;
+
+
+Uint32	settled_timer( Uint32 interval, void *param )
+{
+	SDL_Event	event;
+	
+	event.type = SDL_USEREVENT;
+	event.user.code = EVENT_SETTLED;
+	event.user.data1 = param;
+	SDL_PushEvent( &event );
+	return 0;
+}
+
+// restart the settle delay after zoom or resize input
+void	Settle( void )
+{
+	if (settle_timer)
+		SDL_RemoveTimer( settle_timer );
+	
+	settle_timer = SDL_AddTimer( settle_delay, settled_timer, GUINT_TO_POINTER( ++settle_generation ) );
+	return;
+}
 
 
 void	GetInput( IBuffer *input, SDL_Event *event )
@@ -113,233 +179,759 @@ void	GetInput( IBuffer *input, SDL_Event *event )
 	return;
 }
 
-void	RenderPage( Green_RTD *rtd, SDL_Rect dest, int xoff, int yoff, PopplerPage *page, double tscale )
+// returns the number of highlighted rectangles stored in *res (display coordinates)
+int	GetHighlights( Green_RTD *rtd, SDL_Rect dest, int xoff, int yoff, PopplerPage *page, double tscale, SDL_Rect **res )
 {
-	PopplerRectangle	*rect;
+	PopplerRectangle	rect;
 	Green_Document	*doc = rtd->docs[rtd->doc_cur];
-	SDL_Surface	*display = SDL_GetVideoSurface();
-	SDL_PixelFormat	fmt = *display->format;
-	cairo_surface_t	*surface;
-	cairo_t		*context;
-	void	*pixels;
-	unsigned short	ar, ag, ab, ia;
+	Green_Hits	*hits;
+	SDL_Rect	*hl;
 	gdouble	tmp_d;
-	double	pwidth, pheight;
-	guint	i, n;
-	GList	*list = NULL;
-	Uint32	*src, *dst;
-	int	x, y, rowstride, w, h, dir_x, dir_y;
-
-	if (doc->search_str)
-		list = poppler_page_find_text( page, doc->search_str );
-
-	if (doc->cache.surface && doc->cache.page == doc->page_cur && doc->cache.tscale == tscale)
-		surface = doc->cache.surface;
-	else
+	int	i, count = 0;
+	
+	*res = NULL;
+	hits = Green_GetHits( doc, page, poppler_page_get_index( page ) );
+	if (!hits || hits->count <= 0)
+		return 0;
+	
+	hl = malloc( hits->count * sizeof( *hl ) );
+	for (i = 0; i < hits->count && hl; i++)
 	{
-		Green_GetDimension( page, &w, &h, tscale, false );
-		surface = cairo_image_surface_create( CAIRO_FORMAT_ARGB32, w, h );
-		context = cairo_create( surface );
-		cairo_save( context );
-		cairo_scale( context, tscale, tscale );
-		poppler_page_render( page, context );
-		cairo_restore( context );
-		cairo_set_operator( context, CAIRO_OPERATOR_DEST_OVER );
-		cairo_set_source_rgb( context, 1., 1., 1. );
-		cairo_paint( context );
-		cairo_destroy( context );
-		if (doc->cache.surface)
-			cairo_surface_destroy( doc->cache.surface );
-
-		doc->cache.surface = surface;
-		doc->cache.page = doc->page_cur;
-		doc->cache.tscale = tscale;
+		rect = hits->rects[i];
+		rect.x1 *= tscale;
+		rect.y1 *= tscale;
+		rect.x2 *= tscale;
+		rect.y2 *= tscale;
+		rect.x1 -= xoff;
+		rect.y1 -= yoff;
+		rect.x2 -= xoff;
+		rect.y2 -= yoff;
+		if (doc->rotation % 2)
+		{
+			tmp_d = rect.x1;
+			rect.x1 = rect.y1;
+			rect.y1 = tmp_d;
+			tmp_d = rect.x2;
+			rect.x2 = rect.y2;
+			rect.y2 = tmp_d;
+		}
+		
+		if (doc->mirrored)
+		{
+			tmp_d = rect.y1;
+			rect.y1 = dest.h - rect.y2;
+			rect.y2 = dest.h - tmp_d;
+		}
+		
+		if (doc->rotation == 1)
+		{
+			tmp_d = rect.x1;
+			rect.x1 = dest.w - rect.x2;
+			rect.x2 = dest.w - tmp_d;
+		}
+		else if (doc->rotation == 2)
+		{
+			tmp_d = rect.x1;
+			rect.x1 = dest.w - rect.x2;
+			rect.x2 = dest.w - tmp_d;
+			tmp_d = rect.y1;
+			rect.y1 = dest.h - rect.y2;
+			rect.y2 = dest.h - tmp_d;
+		}
+		else if (doc->rotation == 3)
+		{
+			tmp_d = rect.y1;
+			rect.y1 = dest.h - rect.y2;
+			rect.y2 = dest.h - tmp_d;
+		}
+		
+		if (rect.x1 > dest.w)
+			continue;
+		else if (rect.x1 < 0)
+			rect.x1 = 0;
+		
+		if (rect.x2 < 0)
+			continue;
+		else if (rect.x2 > dest.w)
+			rect.x2 = dest.w;
+		
+		if (rect.y1 > dest.h)
+			continue;
+		else if (rect.y1 < 0)
+			rect.y1 = 0;
+		
+		if (rect.y2 < 0)
+			continue;
+		else if (rect.y2 > dest.h)
+			rect.y2 = dest.h;
+		
+		hl[count].x = dest.x + (int)rect.x1;
+		hl[count].y = dest.y + (int)rect.y1;
+		hl[count].w = (int)rect.x2 - (int)rect.x1;
+		hl[count].h = (int)rect.y2 - (int)rect.y1;
+		count++;
 	}
+	
+	*res = hl;
+	return count;
+}
 
-	if (doc->rotation == 1)
-	{
-		dir_x = -1;
-		dir_y = 1;
-	}
-	else if (doc->rotation == 2)
+// true if every tile needed for the page region (x, y, w, h) is cached
+bool	IsRegionCached( Green_Document *doc, int page_nr, double tscale, int x, int y, int w, int h )
+{
+	int	tx, ty;
+	
+	for (ty = y / GREEN_TILE_SIZE; ty <= (y + h - 1) / GREEN_TILE_SIZE; ty++)
+		for (tx = x / GREEN_TILE_SIZE; tx <= (x + w - 1) / GREEN_TILE_SIZE; tx++)
+			if (!Green_CacheContains( &doc->cache, page_nr, tscale, tx, ty ))
+				return false;
+	
+	return true;
+}
+
+// map the part of surface inside the page region shown in dest to the display,
+// the top left of surface being the page pixel (x, y)
+bool	MapSurface( Green_Document *doc, SDL_Rect dest, int xoff, int yoff, cairo_surface_t *surface, int x, int y, BlitInfo *res )
+{
+	int	px, py, sx1, sy1, sx2, sy2, src_w, src_h, stride, dir_x, dir_y;
+	
+	Green_GetDirection( doc, &dir_x, &dir_y );
+	src_w = doc->rotation % 2 ? dest.h : dest.w;
+	src_h = doc->rotation % 2 ? dest.w : dest.h;
+	
+	// visible part of the surface in page pixels
+	sx1 = x > xoff ? x : xoff;
+	sy1 = y > yoff ? y : yoff;
+	sx2 = x + cairo_image_surface_get_width( surface );
+	sy2 = y + cairo_image_surface_get_height( surface );
+	if (sx2 > xoff + src_w)
+		sx2 = xoff + src_w;
+	
+	if (sy2 > yoff + src_h)
+		sy2 = yoff + src_h;
+	
+	if (sx1 >= sx2 || sy1 >= sy2)
+		return false;
+	
+	// (px, py) is the page pixel that goes to the top left of res->rect
+	stride = cairo_image_surface_get_stride( surface );
+	if (doc->rotation % 2)
 	{
-		dir_x = -1;
-		dir_y = -1;
+		res->rect.x = dest.x + (dir_x > 0 ? sy1 - yoff : yoff + dest.w - sy2);
+		res->rect.y = dest.y + (dir_y > 0 ? sx1 - xoff : xoff + dest.h - sx2);
+		res->rect.w = sy2 - sy1;
+		res->rect.h = sx2 - sx1;
+		res->step_x = dir_x * stride;
+		res->step_y = dir_y * 4;
+		px = dir_y > 0 ? sx1 : sx2 - 1;
+		py = dir_x > 0 ? sy1 : sy2 - 1;
 	}
-	else if (doc->rotation == 3)
+	else
 	{
-		dir_x = 1;
-		dir_y = -1;
+		res->rect.x = dest.x + (dir_x > 0 ? sx1 - xoff : xoff + dest.w - sx2);
+		res->rect.y = dest.y + (dir_y > 0 ? sy1 - yoff : yoff + dest.h - sy2);
+		res->rect.w = sx2 - sx1;
+		res->rect.h = sy2 - sy1;
+		res->step_x = dir_x * 4;
+		res->step_y = dir_y * stride;
+		px = dir_x > 0 ? sx1 : sx2 - 1;
+		py = dir_y > 0 ? sy1 : sy2 - 1;
 	}
-	else
-		dir_x = dir_y = 1;
+	
+	res->src = cairo_image_surface_get_data( surface ) + (py - y) * stride + (px - x) * 4;
+	return true;
+}
 
-	if (doc->mirrored)
-		dir_y *= -1;
+// copy a mapped surface to the locked display and blend the highlights over it
+void	PutSurface( Green_RTD *rtd, SDL_Surface *display, BlitInfo *blit, SDL_Rect *hl, int n )
+{
+	BlitInfo	part;
+	int	i;
+	
+	BlitCopy( display, blit );
+	for (i = 0; i < n; i++)
+		if (BlitClip( blit, &hl[i], &part ))
+			BlitHighlight( display, &part, &rtd->c_highlight );
+	
+	return;
+}
 
-	pixels = cairo_image_surface_get_data( surface );
-	rowstride = cairo_image_surface_get_stride( surface );
+// blit the visible part of the page from its cached tiles, rendering missing ones
+void	RenderPage( Green_RTD *rtd, SDL_Rect dest, int xoff, int yoff, PopplerPage *page, double tscale )
+{
+	Green_Document	*doc = rtd->docs[rtd->doc_cur];
+	SDL_Surface	*display = SDL_GetVideoSurface();
+	cairo_surface_t	*surface;
+	SDL_Rect	*hl;
+	BlitInfo	tile;
+	int	n, tx, ty, src_w, src_h, page_nr = poppler_page_get_index( page );
+	
+	src_w = doc->rotation % 2 ? dest.h : dest.w;
+	src_h = doc->rotation % 2 ? dest.w : dest.h;
+	Green_RenderTiles( &doc->cache, page, page_nr, tscale, xoff, yoff, src_w, src_h );
+	n = GetHighlights( rtd, dest, xoff, yoff, page, tscale, &hl );
 	SDL_LockSurface( display );
-	if (doc->rotation % 2)
+	for (ty = yoff / GREEN_TILE_SIZE; ty <= (yoff + src_h - 1) / GREEN_TILE_SIZE; ty++)
 	{
-		for (y = 0; y < dest.h; y++)
+		for (tx = xoff / GREEN_TILE_SIZE; tx <= (xoff + src_w - 1) / GREEN_TILE_SIZE; tx++)
 		{
-			src = pixels + (xoff + dir_y * y + (dir_y < 0 ? dest.h - 1 : 0)) * 4 + (yoff + (dir_x < 0 ? dest.w - 1 : 0)) * rowstride;
-			dst = display->pixels + (dest.y + y) * display->pitch
-				+ dest.x * fmt.BytesPerPixel;
-			for (x = 0; x < dest.w; x++)
+			surface = Green_CacheLookup( &doc->cache, page_nr, tscale, tx, ty );
+			if (!surface)
 			{
-				*dst = ((((*src>>16)&0xFF)>>fmt.Rloss)<<fmt.Rshift)
-					| ((((*src>>8)&0xFF)>>fmt.Gloss)<<fmt.Gshift)
-					| (((*src&0xFF)>>fmt.Bloss)<<fmt.Bshift);
-				
-				src = (void*)src + dir_x * rowstride;
-				dst = (void*)dst + fmt.BytesPerPixel;
+				// evicted again by its neighbours, the cache is smaller than the screen
+				Green_RenderTiles( &doc->cache, page, page_nr, tscale, tx * GREEN_TILE_SIZE, ty * GREEN_TILE_SIZE, 1, 1 );
+				surface = Green_CacheLookup( &doc->cache, page_nr, tscale, tx, ty );
+				if (!surface)
+					continue;
 			}
+			
+			if (MapSurface( doc, dest, xoff, yoff, surface, tx * GREEN_TILE_SIZE, ty * GREEN_TILE_SIZE, &tile ))
+				PutSurface( rtd, display, &tile, hl, n );
+			
+			cairo_surface_destroy( surface );
+		}
+	}
+	
+	SDL_UnlockSurface( display );
+	free( hl );
+	return;
+}
+
+// show the draft the worker rendered of the page region at a fraction of the
+// scale, its top left being (x, y) at that scale, stretched back to full size
+void	RenderDraft( Green_RTD *rtd, SDL_Rect dest, int xoff, int yoff, PopplerPage *page, double tscale, cairo_surface_t *draft, int x, int y )
+{
+	Green_Document	*doc = rtd->docs[rtd->doc_cur];
+	SDL_Surface	*display = SDL_GetVideoSurface();
+	cairo_surface_t	*surface;
+	cairo_t	*context;
+	SDL_Rect	*hl;
+	BlitInfo	blit;
+	int	n, src_w, src_h;
+	
+	src_w = doc->rotation % 2 ? dest.h : dest.w;
+	src_h = doc->rotation % 2 ? dest.w : dest.h;
+	surface = cairo_image_surface_create( CAIRO_FORMAT_ARGB32, src_w, src_h );
+	context = cairo_create( surface );
+	cairo_set_source_rgb( context, 1., 1., 1. );
+	cairo_paint( context );
+	cairo_translate( context, x * GREEN_DRAFT_FACTOR - xoff, y * GREEN_DRAFT_FACTOR - yoff );
+	cairo_scale( context, GREEN_DRAFT_FACTOR, GREEN_DRAFT_FACTOR );
+	cairo_set_source_surface( context, draft, 0, 0 );
+	cairo_pattern_set_filter( cairo_get_source( context ), CAIRO_FILTER_BILINEAR );
+	cairo_paint( context );
+	cairo_destroy( context );
+	cairo_surface_flush( surface );
+	n = GetHighlights( rtd, dest, xoff, yoff, page, tscale, &hl );
+	SDL_LockSurface( display );
+	if (MapSurface( doc, dest, xoff, yoff, surface, xoff, yoff, &blit ))
+		PutSurface( rtd, display, &blit, hl, n );
+	
+	SDL_UnlockSurface( display );
+	cairo_surface_destroy( surface );
+	free( hl );
+	return;
+}
+
+// the page region (x1, y1) to (x2, y2) at the scale of the last finished frame
+// behind the region shown in dest at tscale; false unless it is all cached
+bool	PreviewRegion( Green_Document *doc, SDL_Rect dest, int xoff, int yoff, double tscale, int *region )
+{
+	double	ratio = presented.crisp / tscale;
+	int	pw, ph, src_w, src_h;
+	
+	if (!presented.crisp)
+		return false;
+	
+	src_w = doc->rotation % 2 ? dest.h : dest.w;
+	src_h = doc->rotation % 2 ? dest.w : dest.h;
+	Green_GetPageDimension( doc, doc->page_cur, &pw, &ph, presented.crisp, false );
+	region[0] = xoff * ratio > 0 ? xoff * ratio : 0;
+	region[1] = yoff * ratio > 0 ? yoff * ratio : 0;
+	region[2] = (xoff + src_w) * ratio + 1 < pw ? (xoff + src_w) * ratio + 1 : pw;
+	region[3] = (yoff + src_h) * ratio + 1 < ph ? (yoff + src_h) * ratio + 1 : ph;
+	return region[0] < region[2] && region[1] < region[3]
+		&& IsRegionCached( doc, doc->page_cur, presented.crisp, region[0], region[1], region[2] - region[0], region[3] - region[1] );
+}
+
+// show the page region stretched from the tiles cached at the scale of the last
+// finished frame; false if any of them is missing
+bool	RenderPreview( Green_RTD *rtd, SDL_Rect dest, int xoff, int yoff, PopplerPage *page, double tscale )
+{
+	Green_Document	*doc = rtd->docs[rtd->doc_cur];
+	SDL_Surface	*display = SDL_GetVideoSurface();
+	cairo_surface_t	*surface, *tile;
+	cairo_t	*context;
+	SDL_Rect	*hl;
+	BlitInfo	blit;
+	double	ratio = presented.crisp / tscale;
+	int	n, tx, ty, region[4], src_w, src_h;
+	
+	if (!PreviewRegion( doc, dest, xoff, yoff, tscale, region ))
+		return false;
+	
+	src_w = doc->rotation % 2 ? dest.h : dest.w;
+	src_h = doc->rotation % 2 ? dest.w : dest.h;
+	surface = cairo_image_surface_create( CAIRO_FORMAT_ARGB32, src_w, src_h );
+	context = cairo_create( surface );
+	cairo_set_source_rgb( context, 1., 1., 1. );
+	cairo_paint( context );
+	cairo_scale( context, 1 / ratio, 1 / ratio );
+	cairo_translate( context, -xoff * ratio, -yoff * ratio );
+	for (ty = region[1] / GREEN_TILE_SIZE; ty <= (region[3] - 1) / GREEN_TILE_SIZE; ty++)
+	{
+		for (tx = region[0] / GREEN_TILE_SIZE; tx <= (region[2] - 1) / GREEN_TILE_SIZE; tx++)
+		{
+			if (!(tile = Green_CacheLookup( &doc->cache, doc->page_cur, presented.crisp, tx, ty )))
+				continue;
+			
+			// padding keeps the filter from blending the tile edges with nothing
+			cairo_set_source_surface( context, tile, tx * GREEN_TILE_SIZE, ty * GREEN_TILE_SIZE );
+			cairo_pattern_set_filter( cairo_get_source( context ), CAIRO_FILTER_BILINEAR );
+			cairo_pattern_set_extend( cairo_get_source( context ), CAIRO_EXTEND_PAD );
+			cairo_rectangle( context, tx * GREEN_TILE_SIZE, ty * GREEN_TILE_SIZE,
+				cairo_image_surface_get_width( tile ), cairo_image_surface_get_height( tile ) );
+			cairo_fill( context );
+			cairo_surface_destroy( tile );
 		}
 	}
+	
+	cairo_destroy( context );
+	cairo_surface_flush( surface );
+	n = GetHighlights( rtd, dest, xoff, yoff, page, tscale, &hl );
+	SDL_LockSurface( display );
+	if (MapSurface( doc, dest, xoff, yoff, surface, xoff, yoff, &blit ))
+		PutSurface( rtd, display, &blit, hl, n );
+	
+	SDL_UnlockSurface( display );
+	cairo_surface_destroy( surface );
+	free( hl );
+	return true;
+}
+
+// true if the presented frame shows the same page of doc, or the same continuous
+// layout, in the same orientation
+bool	IsSameView( Green_Document *doc )
+{
+	return presented.doc == doc && presented.continuous == doc->continuous
+		&& (presented.page == doc->page_cur || doc->continuous)
+		&& presented.rotation == doc->rotation && presented.mirrored == doc->mirrored;
+}
+
+// true if the presented frame shows rect of the same view at tscale, maybe at another offset
+bool	IsPresented( Green_Document *doc, SDL_Rect rect, double tscale )
+{
+	return IsSameView( doc ) && presented.display == SDL_GetVideoSurface()
+		&& presented.tscale == tscale && presented.search_str == doc->search_str
+		&& presented.rect.x == rect.x && presented.rect.y == rect.y
+		&& presented.rect.w == rect.w && presented.rect.h == rect.h;
+}
+
+// the page pixel (x, y) shown at the top left of the display rectangle part
+// of a page shown in dest at (xoff, yoff)
+void	PartOffset( Green_Document *doc, SDL_Rect dest, int xoff, int yoff, SDL_Rect part, int *x, int *y )
+{
+	int	dir_x, dir_y, off_x, off_y;
+	
+	Green_GetDirection( doc, &dir_x, &dir_y );
+	off_x = dir_x > 0 ? part.x - dest.x : dest.x + dest.w - part.x - part.w;
+	off_y = dir_y > 0 ? part.y - dest.y : dest.y + dest.h - part.y - part.h;
+	*x = xoff + (doc->rotation % 2 ? off_y : off_x);
+	*y = yoff + (doc->rotation % 2 ? off_x : off_y);
+	return;
+}
+
+// render the display rectangle part of a page shown in dest at (xoff, yoff)
+void	RenderPart( Green_RTD *rtd, SDL_Rect dest, int xoff, int yoff, PopplerPage *page, double tscale, SDL_Rect part )
+{
+	int	x, y;
+	
+	PartOffset( rtd->docs[rtd->doc_cur], dest, xoff, yoff, part, &x, &y );
+	RenderPage( rtd, part, x, y, page, tscale );
+	return;
+}
+
+// show a strip exposed by scrolling from the cache; what is not cached stays
+// blank while the worker renders the request generation, unless there is none
+void	RenderStrip( Green_RTD *rtd, SDL_Rect dest, PopplerPage *page, double tscale, SDL_Rect part, unsigned int generation )
+{
+	Green_Document	*doc = rtd->docs[rtd->doc_cur];
+	SDL_Surface	*display = SDL_GetVideoSurface();
+	int	x, y;
+	
+	PartOffset( doc, dest, doc->xoffset, doc->yoffset, part, &x, &y );
+	if (generation && !IsRegionCached( doc, doc->page_cur, tscale, x, y,
+		doc->rotation % 2 ? part.h : part.w, doc->rotation % 2 ? part.w : part.h ))
+		SDL_FillRect( display, &part, SDL_MapRGB( display->format, 255, 255, 255 ) );
+	else
+		RenderPart( rtd, dest, doc->xoffset, doc->yoffset, page, tscale, part );
+	
+	return;
+}
+
+// try to present a pure scroll by moving the presented frame and showing only
+// the exposed strips, which the worker renders if they are not cached; false if
+// the screen has to be redrawn completely
+bool	RenderScroll( Green_RTD *rtd, SDL_Rect rect, PopplerPage *page, double tscale )
+{
+	Green_Document	*doc = rtd->docs[rtd->doc_cur];
+	SDL_Surface	*display = SDL_GetVideoSurface();
+	SDL_Rect	part;
+	unsigned int	generation = 0;
+	int	dx, dy, dir_x, dir_y, w, h;
+	bool	cached;
+	
+	if ((presented.draft && !presented.strips) || !IsPresented( doc, rect, tscale ))
+		return false;
+	
+	// the content moves against the offset, in display directions
+	Green_GetDirection( doc, &dir_x, &dir_y );
+	if (doc->rotation % 2)
+	{
+		dx = dir_x * (presented.yoffset - doc->yoffset);
+		dy = dir_y * (presented.xoffset - doc->xoffset);
+	}
 	else
 	{
-		for (y = 0; y < dest.h; y++)
+		dx = dir_x * (presented.xoffset - doc->xoffset);
+		dy = dir_y * (presented.yoffset - doc->yoffset);
+	}
+	
+	if (abs( dx ) >= rect.w || abs( dy ) >= rect.h)
+		return false;
+	
+	// blank strips are filled by redrawing the frame once the worker is done
+	w = doc->rotation % 2 ? rect.h : rect.w;
+	h = doc->rotation % 2 ? rect.w : rect.h;
+	cached = IsRegionCached( doc, doc->page_cur, tscale, doc->xoffset, doc->yoffset, w, h );
+	if (presented.strips && (cached || (!dx && !dy)))
+		return false;
+	
+	if (dx || dy)
+	{
+		if (!cached)
+			generation = Green_PrefetchCurrent( &rtd->prefetch, doc, doc->page_cur, tscale, doc->xoffset, doc->yoffset, w, h, false );
+		
+		SDL_LockSurface( display );
+		BlitScroll( display, &rect, dx, dy );
+		SDL_UnlockSurface( display );
+		
+		// the exposed rows over the whole width, then the exposed columns beside the kept part
+		part = rect;
+		part.h = abs( dy );
+		part.y = dy > 0 ? rect.y : rect.y + rect.h - part.h;
+		if (part.h)
+			RenderStrip( rtd, rect, page, tscale, part, generation );
+		
+		part.w = abs( dx );
+		part.x = dx > 0 ? rect.x : rect.x + rect.w - part.w;
+		part.h = rect.h - abs( dy );
+		part.y = dy > 0 ? rect.y + dy : rect.y;
+		if (part.w)
+			RenderStrip( rtd, rect, page, tscale, part, generation );
+		
+		SDL_UpdateRects( display, 1, &rect );
+	}
+	
+	if (generation)
+	{
+		render_generation = generation;
+		presented.draft = presented.strips = true;
+	}
+	
+	presented.xoffset = doc->xoffset;
+	presented.yoffset = doc->yoffset;
+	return true;
+}
+
+// draw the part clip of the display in continuous mode from the cache, the top
+// of the display being pos pixels down the layout; the first page part that is
+// not cached goes to the worker and the rest stay blank until it is done, unless
+// there is no worker; returns the generation of the request, 0 if none was made
+unsigned int	RenderBand( Green_RTD *rtd, SDL_Rect clip, int pos, double tscale )
+{
+	Green_Document	*doc = rtd->docs[rtd->doc_cur];
+	SDL_Surface	*display = SDL_GetVideoSurface();
+	PopplerPage	*page;
+	SDL_Rect	dest, part;
+	unsigned int	generation = 0;
+	int	i, w, h, x, y, x1, y1, x2, y2;
+	
+	SDL_FillRect( display, &clip, SDL_MapRGB( display->format, rtd->c_background.r, rtd->c_background.g, rtd->c_background.b ));
+	for (i = Green_PageAt( doc, pos + clip.y, tscale ); i < doc->page_count; i++)
+	{
+		Green_GetPageDimension( doc, i, &w, &h, tscale, doc->rotation % 2 );
+		dest.y = Green_PageTop( doc, i, tscale ) - pos;
+		if (dest.y >= clip.y + clip.h)
+			break;
+		
+		// narrow pages are centered, wide ones follow the horizontal offset
+		dest.x = w <= display->w ? (display->w - w) / 2 : doc->xoffset < w - display->w ? -doc->xoffset : display->w - w;
+		dest.w = w;
+		dest.h = h;
+		x1 = dest.x > clip.x ? dest.x : clip.x;
+		y1 = dest.y > clip.y ? dest.y : clip.y;
+		x2 = dest.x + w < clip.x + clip.w ? dest.x + w : clip.x + clip.w;
+		y2 = dest.y + h < clip.y + clip.h ? dest.y + h : clip.y + clip.h;
+		if (x1 >= x2 || y1 >= y2)
+			continue;
+		
+		part.x = x1;
+		part.y = y1;
+		part.w = x2 - x1;
+		part.h = y2 - y1;
+		PartOffset( doc, dest, 0, 0, part, &x, &y );
+		w = doc->rotation % 2 ? part.h : part.w;
+		h = doc->rotation % 2 ? part.w : part.h;
+		if (!IsRegionCached( doc, i, tscale, x, y, w, h ))
 		{
-			src = pixels + (yoff + dir_y * y + (dir_y < 0 ? dest.h - 1 : 0)) * rowstride + (xoff + (dir_x < 0 ? dest.w - 1 : 0)) * 4;
-			dst = display->pixels + (dest.y + y) * display->pitch
-				+ dest.x * fmt.BytesPerPixel;
-			for (x = 0; x < dest.w; x++)
+			if (!generation)
+				generation = Green_PrefetchCurrent( &rtd->prefetch, doc, i, tscale, x, y, w, h, false );
+			
+			if (generation)
 			{
-				*dst = ((((*src>>16)&0xFF)>>fmt.Rloss)<<fmt.Rshift)
-					| ((((*src>>8)&0xFF)>>fmt.Gloss)<<fmt.Gshift)
-					| (((*src&0xFF)>>fmt.Bloss)<<fmt.Bshift);
-				
-				src += dir_x;
-				dst = (void*)dst + fmt.BytesPerPixel;
+				SDL_FillRect( display, &part, SDL_MapRGB( display->format, 255, 255, 255 ) );
+				continue;
 			}
 		}
+		
+		page = poppler_document_get_page( doc->doc, i );
+		RenderPage( rtd, part, x, y, page, tscale );
+		g_object_unref( G_OBJECT( page ) );
 	}
 	
-	if (list)
+	return generation;
+}
+
+// present the continuous layout, moving the presented frame if it was only
+// scrolled vertically; blank pages are filled by redrawing the layout once the
+// worker rendered them, one page per round
+void	RenderContinuous( Green_RTD *rtd, Green_Document *doc )
+{
+	SDL_Surface	*display = SDL_GetVideoSurface();
+	SDL_Rect	rect, part;
+	unsigned int	generation = 0;
+	double	tscale;
+	int	pos, dy;
+	bool	draft = false;
+	
+	rect.x = rect.y = 0;
+	rect.w = display->w;
+	rect.h = display->h;
+	tscale = Green_Fit( doc, display->w, display->h ) * doc->finescale;
+	pos = Green_PageTop( doc, doc->page_cur, tscale ) + doc->yoffset;
+	dy = presented.pos - pos;
+	if ((dy || !presented.draft) && IsPresented( doc, rect, tscale ) && presented.xoffset == doc->xoffset && abs( dy ) < rect.h)
 	{
-		poppler_page_get_size( page, &pwidth, &pheight );
-		ar = rtd->c_highlight.a * rtd->c_highlight.r;
-		ag = rtd->c_highlight.a * rtd->c_highlight.g;
-		ab = rtd->c_highlight.a * rtd->c_highlight.b;
-		ia = 0xFF - rtd->c_highlight.a;
-		n = g_list_length( list );
-		for (i = 0; i < n; i++)
+		draft = presented.draft;
+		if (dy)
 		{
-			rect = g_list_nth_data( list, i );
-			tmp_d = pheight - rect->y2;
-			rect->y2 = pheight - rect->y1;
-			rect->y1 = tmp_d;
-			rect->x1 *= tscale;
-			rect->y1 *= tscale;
-			rect->x2 *= tscale;
-			rect->y2 *= tscale;
-			rect->x1 -= xoff;
-			rect->y1 -= yoff;
-			rect->x2 -= xoff;
-			rect->y2 -= yoff;
-			if (doc->rotation % 2)
-			{
-				tmp_d = rect->x1;
-				rect->x1 = rect->y1;
-				rect->y1 = tmp_d;
-				tmp_d = rect->x2;
-				rect->x2 = rect->y2;
-				rect->y2 = tmp_d;
-			}
+			SDL_LockSurface( display );
+			BlitScroll( display, &rect, 0, dy );
+			SDL_UnlockSurface( display );
+			part = rect;
+			part.h = abs( dy );
+			part.y = dy > 0 ? 0 : rect.h - part.h;
+			generation = RenderBand( rtd, part, pos, tscale );
+			SDL_UpdateRects( display, 1, &rect );
+		}
+	}
+	else
+	{
+		generation = RenderBand( rtd, rect, pos, tscale );
+		SDL_UpdateRect( display, 0, 0, 0, 0 );
+	}
+	
+	if (generation)
+		render_generation = generation;
+	
+	presented.display = display;
+	presented.doc = doc;
+	presented.continuous = true;
+	presented.draft = draft || generation;
+	presented.strips = false;
+	presented.crisp = tscale;
+	presented.search_str = doc->search_str;
+	presented.page = doc->page_cur;
+	presented.rotation = doc->rotation;
+	presented.mirrored = doc->mirrored;
+	presented.xoffset = doc->xoffset;
+	presented.yoffset = doc->yoffset;
+	presented.pos = pos;
+	presented.tscale = tscale;
+	presented.rect = rect;
+	return;
+}
 
-			if (doc->mirrored)
-			{
-				tmp_d = rect->y1;
-				rect->y1 = dest.h - rect->y2;
-				rect->y2 = dest.h - tmp_d;
-			}
+// returns the number of columns of the overview grid, and its rows and top left
+int	OverviewGrid( SDL_Surface *display, int *rows, int *x, int *y )
+{
+	int	cell = GREEN_THUMB_SIZE + thumb_margin, cols;
+	
+	cols = display->w / cell > 0 ? display->w / cell : 1;
+	*rows = display->h / cell > 0 ? display->h / cell : 1;
+	*x = (display->w - cols * cell + thumb_margin) / 2;
+	*y = (display->h - *rows * cell + thumb_margin) / 2;
+	return cols;
+}
 
-			if (doc->rotation == 1)
-			{
-				tmp_d = rect->x1;
-				rect->x1 = dest.w - rect->x2;
-				rect->x2 = dest.w - tmp_d;
-			}
-			else if (doc->rotation == 2)
-			{
-				tmp_d = rect->x1;
-				rect->x1 = dest.w - rect->x2;
-				rect->x2 = dest.w - tmp_d;
-				tmp_d = rect->y1;
-				rect->y1 = dest.h - rect->y2;
-				rect->y2 = dest.h - tmp_d;
-			}
-			else if (doc->rotation == 3)
-			{
-				tmp_d = rect->y1;
-				rect->y1 = dest.h - rect->y2;
-				rect->y2 = dest.h - tmp_d;
-			}
+// runs on the thumbnail worker
+void	ThumbsDone( void )
+{
+	SDL_Event	event;
+	
+	event.type = SDL_USEREVENT;
+	event.user.code = EVENT_THUMBS;
+	SDL_PushEvent( &event );
+	return;
+}
 
-			if (rect->x1 > dest.w)
-				continue;
-			else if (rect->x1 < 0)
-				rect->x1 = 0;
-			
-			if (rect->x2 < 0)
-				continue;
-			else if (rect->x2 > dest.w)
-				rect->x2 = dest.w;
-			
-			if (rect->y1 > dest.h)
-				continue;
-			else if (rect->y1 < 0)
-				rect->y1 = 0;
-			
-			if (rect->y2 < 0)
-				continue;
-			else if (rect->y2 > dest.h)
-				rect->y2 = dest.h;
-			
-			if (doc->rotation % 2)
-			{
-				for (y = rect->y1; y < (int)rect->y2; y++)
-				{
-					src = pixels + (xoff + dir_y * y + (dir_y < 0 ? dest.h - 1 : 0)) * 4 + (yoff + dir_x * (int)rect->x1 + (dir_x < 0 ? dest.w - 1 : 0)) * rowstride;
-					dst = display->pixels + (dest.y + y) * display->pitch
-						+ (dest.x + (int)rect->x1) * fmt.BytesPerPixel;
-					for (x = rect->x1; x < (int)rect->x2; x++)
-					{
-						*dst = ((((((*src>>16)&0xFF) * ia + ar) / 256)>>fmt.Rloss)<<fmt.Rshift)
-							| ((((((*src>>8)&0xFF) * ia + ag) / 256)>>fmt.Gloss)<<fmt.Gshift)
-							| (((((*src&0xFF) * ia + ab) / 256)>>fmt.Bloss)<<fmt.Bshift);
-						
-						src = (void*)src + dir_x * rowstride;
-						dst = (void*)dst + fmt.BytesPerPixel;
-					}
-				}
-			}
-			else
-			{
-				for (y = rect->y1; y < (int)rect->y2; y++)
-				{
-					src = pixels + (yoff + dir_y * y + (dir_y < 0 ? dest.h - 1 : 0)) * rowstride + (xoff + dir_x * (int)rect->x1 + (dir_x < 0 ? dest.w - 1 : 0)) * 4;
-					dst = display->pixels + (dest.y + y) * display->pitch
-						+ (dest.x + (int)rect->x1) * fmt.BytesPerPixel;
-					for (x = rect->x1; x < (int)rect->x2; x++)
-					{
-						*dst = ((((((*src>>16)&0xFF) * ia + ar) / 256)>>fmt.Rloss)<<fmt.Rshift)
-							| ((((((*src>>8)&0xFF) * ia + ag) / 256)>>fmt.Gloss)<<fmt.Gshift)
-							| (((((*src&0xFF) * ia + ab) / 256)>>fmt.Bloss)<<fmt.Bshift);
-						
-						src += dir_x;
-						dst = (void*)dst + fmt.BytesPerPixel;
-					}
-				}
-			}
+// show the thumbnails around the current page in a grid, the current one framed;
+// pages the worker has not reached yet are shown as grey boxes of their size
+void	RenderOverview( Green_RTD *rtd, Green_Document *doc )
+{
+	SDL_Surface	*display = SDL_GetVideoSurface(), *surface;
+	SDL_Rect	rect, frame;
+	Green_Thumb	thumb;
+	double	pwidth, pheight, scale;
+	int	i, cols, rows, x, y, last, cell = GREEN_THUMB_SIZE + thumb_margin;
+	
+	// the grid scrolls by rows to keep the current page on it
+	cols = OverviewGrid( display, &rows, &x, &y );
+	overview.top -= overview.top % cols;
+	if (doc->page_cur < overview.top)
+		overview.top = doc->page_cur - doc->page_cur % cols;
+	else if (doc->page_cur >= overview.top + cols * rows)
+		overview.top = (doc->page_cur / cols - rows + 1) * cols;
+	
+	last = overview.top + cols * rows < doc->page_count ? overview.top + cols * rows : doc->page_count;
+	Green_ThumbsShow( doc, overview.top, last - 1, ThumbsDone );
+	SDL_FillRect( display, NULL, SDL_MapRGB( display->format, rtd->c_background.r, rtd->c_background.g, rtd->c_background.b ));
+	for (i = overview.top; i < last; i++)
+	{
+		thumb = Green_ThumbGet( &doc->thumbs, i );
+		if (!thumb.width)
+		{
+			Green_GetPageSize( doc, i, &pwidth, &pheight );
+			scale = GREEN_THUMB_SIZE / (pwidth > pheight ? pwidth : pheight);
+			thumb.width = pwidth * scale;
+			thumb.height = pheight * scale;
 		}
 		
-		g_list_free( list );
+		rect.x = x + (i - overview.top) % cols * cell + (GREEN_THUMB_SIZE - thumb.width) / 2;
+		rect.y = y + (i - overview.top) / cols * cell + (GREEN_THUMB_SIZE - thumb.height) / 2;
+		rect.w = thumb.width;
+		rect.h = thumb.height;
+		if (i == doc->page_cur)
+		{
+			frame.x = rect.x - thumb_margin / 4;
+			frame.y = rect.y - thumb_margin / 4;
+			frame.w = rect.w + thumb_margin / 2;
+			frame.h = rect.h + thumb_margin / 2;
+			SDL_FillRect( display, &frame, SDL_MapRGB( display->format, rtd->c_highlight.r, rtd->c_highlight.g, rtd->c_highlight.b ));
+		}
+		
+		surface = thumb.pixels ? SDL_CreateRGBSurfaceFrom( thumb.pixels, thumb.width, thumb.height, 16, thumb.width * 2, 0xF800, 0x07E0, 0x001F, 0 ) : NULL;
+		if (surface)
+		{
+			SDL_BlitSurface( surface, NULL, display, &rect );
+			SDL_FreeSurface( surface );
+		}
+		else
+			SDL_FillRect( display, &rect, SDL_MapRGB( display->format, 0xC0, 0xC0, 0xC0 ));
 	}
 	
-	SDL_UnlockSurface( display );
+	SDL_UpdateRect( display, 0, 0, 0, 0 );
+	presented.doc = NULL;
+	return;
+}
+
+// select a page in the overview, kept inside the document
+void	OverviewSelect( Green_Document *doc, int page, unsigned short *flags )
+{
+	doc->page_cur = page < 0 ? 0 : page >= doc->page_count ? doc->page_count - 1 : page;
+	*flags |= FLAG_RENDER;
+	return;
+}
+
+// move the selection by rows, as the mouse wheel does
+void	OverviewScroll( Green_Document *doc, int rows, unsigned short *flags )
+{
+	int	x, y, r;
+	
+	OverviewSelect( doc, doc->page_cur + rows * OverviewGrid( SDL_GetVideoSurface(), &r, &x, &y ), flags );
+	return;
+}
+
+// leave the overview for the selected page
+void	OverviewOpen( Green_Document *doc, unsigned short *flags )
+{
+	overview.active = false;
+	Green_GotoPage( doc, doc->page_cur, true );
+	Green_ValidateOffset( doc, SDL_GetVideoSurface()->w, SDL_GetVideoSurface()->h );
+	*flags |= FLAG_RENDER;
+	return;
+}
+
+void	OverviewInput( Green_RTD *rtd, SDL_Event *event, unsigned short *flags )
+{
+	Green_Document	*doc = rtd->docs[rtd->doc_cur];
+	int	cols, rows, x, y;
+	
+	cols = OverviewGrid( SDL_GetVideoSurface(), &rows, &x, &y );
+	switch (event->key.keysym.sym)
+	{
+		case SDLK_LEFT:
+		case SDLK_h:
+			OverviewSelect( doc, doc->page_cur - 1, flags );
+			break;
+		case SDLK_RIGHT:
+		case SDLK_l:
+			OverviewSelect( doc, doc->page_cur + 1, flags );
+			break;
+		case SDLK_UP:
+		case SDLK_k:
+			OverviewSelect( doc, doc->page_cur - cols, flags );
+			break;
+		case SDLK_DOWN:
+		case SDLK_j:
+			OverviewSelect( doc, doc->page_cur + cols, flags );
+			break;
+		case SDLK_PAGEUP:
+			OverviewSelect( doc, doc->page_cur - cols * rows, flags );
+			break;
+		case SDLK_PAGEDOWN:
+			OverviewSelect( doc, doc->page_cur + cols * rows, flags );
+			break;
+		case SDLK_RETURN:
+		case SDLK_o:
+			OverviewOpen( doc, flags );
+			break;
+		default:
+			break;
+	}
+	
+	return;
+}
+
+// open the page whose thumbnail is at the display position (x, y)
+void	OverviewClick( Green_RTD *rtd, int x, int y, unsigned short *flags )
+{
+	Green_Document	*doc = rtd->docs[rtd->doc_cur];
+	int	cols, rows, gx, gy, page, cell = GREEN_THUMB_SIZE + thumb_margin;
+	
+	cols = OverviewGrid( SDL_GetVideoSurface(), &rows, &gx, &gy );
+	x += thumb_margin / 2 - gx;
+	y += thumb_margin / 2 - gy;
+	if (x < 0 || y < 0 || x / cell >= cols || y / cell >= rows)
+		return;
+	
+	page = overview.top + y / cell * cols + x / cell;
+	if (page >= doc->page_count)
+		return;
+	
+	doc->page_cur = page;
+	OverviewOpen( doc, flags );
 	return;
 }
 
@@ -349,30 +941,138 @@ void	Render( Green_RTD *rtd )
 	PopplerPage	*page = NULL;
 	SDL_Surface	*display = SDL_GetVideoSurface();
 	SDL_Rect	rect;
+	cairo_surface_t	*draft = NULL;
+	unsigned int	generation = 0;
 	double	tscale;
-	int	w, h;
+	bool	same, preview = false;
+	int	w, h, x, y, region[4];
 	
 	rect.x = rect.y = 0;
 	rect.w = display->w;
 	rect.h = display->h;
-	SDL_FillRect( display, &rect, SDL_MapRGB( display->format, rtd->c_background.r, rtd->c_background.g, rtd->c_background.b ));
 	if (!Green_IsDocValid( rtd, rtd->doc_cur ))
 	{
+		presented.doc = NULL;
+		overview.active = false;
+		Green_CacheSetCurrent( NULL, -1 );
+		SDL_FillRect( display, &rect, SDL_MapRGB( display->format, rtd->c_background.r, rtd->c_background.g, rtd->c_background.b ));
 		SDL_UpdateRect( display, 0, 0, 0, 0 );
 		return;
 	}
 	
 	doc = rtd->docs[rtd->doc_cur];
+	Green_CacheSetCurrent( &doc->cache, doc->page_cur );
+	if (overview.active)
+	{
+		RenderOverview( rtd, doc );
+		return;
+	}
+	
+	if (doc->continuous)
+	{
+		RenderContinuous( rtd, doc );
+		Green_PrefetchRequest( rtd, doc, display->w, display->h );
+		return;
+	}
+	
 	tscale = Green_Fit( doc, display->w, display->h ) * doc->finescale;
 	page = poppler_document_get_page( doc->doc, doc->page_cur );
-	Green_GetDimension( page, &w, &h, tscale, doc->rotation % 2 );
+	Green_GetPageDimension( doc, doc->page_cur, &w, &h, tscale, doc->rotation % 2 );
 	rect.w = w > display->w ? display->w : w;
 	rect.h = h > display->h ? display->h : h;
 	rect.x = (display->w - rect.w) / 2;
 	rect.y = (display->h - rect.h) / 2;
-	RenderPage( rtd, rect, doc->xoffset, doc->yoffset, page, tscale );
+	if (!RenderScroll( rtd, rect, page, tscale ))
+	{
+		// a region that is not cached is rendered by the worker, meanwhile the tiles
+		// of the old scale are stretched or else the worker drafts it first; while
+		// zoom or resize input keeps coming the worker only gets what cannot be stretched
+		w = doc->rotation % 2 ? rect.h : rect.w;
+		h = doc->rotation % 2 ? rect.w : rect.h;
+		same = IsSameView( doc );
+		if (!IsRegionCached( doc, doc->page_cur, tscale, doc->xoffset, doc->yoffset, w, h ))
+		{
+			preview = same && PreviewRegion( doc, rect, doc->xoffset, doc->yoffset, tscale, region );
+			if (!settle_timer || !preview)
+				generation = Green_PrefetchCurrent( &rtd->prefetch, doc, doc->page_cur, tscale, doc->xoffset, doc->yoffset, w, h, !preview );
+			
+			if (generation)
+				render_generation = generation;
+			
+			if (generation && !preview)
+				draft = Green_PrefetchDraft( &rtd->prefetch, generation, &x, &y );
+		}
+		
+		presented.draft = preview || generation;
+		presented.strips = false;
+		
+		// without anything to show of the new frame the old one stays until the draft is done
+		if (presented.draft && !preview && !draft && presented.doc && presented.display == display
+			&& presented.rect.x == rect.x && presented.rect.y == rect.y
+			&& presented.rect.w == rect.w && presented.rect.h == rect.h)
+		{
+			g_object_unref( G_OBJECT( page ) );
+			return;
+		}
+		
+		SDL_FillRect( display, NULL, SDL_MapRGB( display->format, rtd->c_background.r, rtd->c_background.g, rtd->c_background.b ));
+		if (!presented.draft)
+			RenderPage( rtd, rect, doc->xoffset, doc->yoffset, page, tscale );
+		else if (preview)
+			RenderPreview( rtd, rect, doc->xoffset, doc->yoffset, page, tscale );
+		else if (draft)
+		{
+			RenderDraft( rtd, rect, doc->xoffset, doc->yoffset, page, tscale, draft, x, y );
+			cairo_surface_destroy( draft );
+		}
+		
+		SDL_UpdateRect( display, 0, 0, 0, 0 );
+		if (!presented.draft)
+			presented.crisp = tscale;
+		else if (!same)
+			presented.crisp = 0;
+		
+		presented.display = display;
+		presented.doc = doc;
+		presented.continuous = false;
+		presented.search_str = doc->search_str;
+		presented.page = doc->page_cur;
+		presented.rotation = doc->rotation;
+		presented.mirrored = doc->mirrored;
+		presented.xoffset = doc->xoffset;
+		presented.yoffset = doc->yoffset;
+		presented.tscale = tscale;
+		presented.rect = rect;
+	}
+	
 	g_object_unref( G_OBJECT( page ) );
-	SDL_UpdateRect( display, 0, 0, 0, 0 );
+	if (!settle_timer)
+		Green_PrefetchRequest( rtd, doc, display->w, display->h );
+	
+	return;
+}
+
+// show the page with the next hit, or drop a search string without any
+void	SearchFound( Green_Document *doc, int page, unsigned short *flags )
+{
+	if (page < 0)
+	{
+		free( doc->search_str );
+		doc->search_str = NULL;
+	}
+	else
+		doc->page_cur = page;
+	
+	*flags |= FLAG_RENDER;
+	return;
+}
+
+// look for the next page with hits from start on, in the background if possible
+void	Search( Green_RTD *rtd, Green_Document *doc, int start, unsigned short *flags )
+{
+	if (!Green_SearchStart( &rtd->search, doc, start ))
+		SearchFound( doc, Green_FindNext( doc, start ), flags );
+	
 	return;
 }
 
@@ -406,12 +1106,30 @@ RState	NormalInput( Green_RTD *rtd, SDL_Event *event, unsigned short *flags )
 			if (!doc || !doc->search_str)
 				break;
 			
-			doc->page_cur = Green_FindNext( doc, doc->page_cur + 1 );
-			*flags |= FLAG_RENDER;
+			Search( rtd, doc, doc->page_cur + 1, flags );
 			break;
 		case 'f':
 			state = FIT;
 			break;
+		case 'o':
+			if (!doc)
+				break;
+			
+			overview.active = true;
+			overview.page = doc->page_cur;
+			*flags |= FLAG_RENDER;
+			break;
+		case 'v':
+			if (!doc)
+				break;
+			
+			// switch between single pages and the continuous layout, staying on the page
+			doc->continuous = !doc->continuous;
+			doc->xoffset = 0;
+			doc->yoffset = 0;
+			Green_ValidateOffset( doc, display->w, display->h );
+			*flags |= FLAG_RENDER;
+			break;
 		case SDLK_UP:
 			if (!doc)
 				break;
@@ -496,6 +1214,7 @@ RState	NormalInput( Green_RTD *rtd, SDL_Event *event, unsigned short *flags )
 				break;
 			
 			Green_Zoom( doc, display->w,display->h, doc->finescale * rtd->zoomstep );
+			Settle();
 			*flags |= FLAG_RENDER;
 			break;
 		case '-':
@@ -503,6 +1222,7 @@ RState	NormalInput( Green_RTD *rtd, SDL_Event *event, unsigned short *flags )
 				break;
 			
 			Green_Zoom( doc, display->w,display->h, doc->finescale / rtd->zoomstep );
+			Settle();
 			*flags |= FLAG_RENDER;
 			break;
 		case SDLK_F12:
@@ -528,7 +1248,8 @@ RState	NormalInput( Green_RTD *rtd, SDL_Event *event, unsigned short *flags )
 		case SDLK_F2:
 			f++;
 		case SDLK_F1:
-			if (!Green_IsDocValid( rtd, f ))
+			// a document still being opened can be chosen, it shows once it is there
+			if (f >= rtd->doc_count || !rtd->docs[f])
 				break;
 			
 			rtd->doc_cur = f;
@@ -550,24 +1271,62 @@ Uint32	live_timer( Uint32 interval, void *param )
 	SDL_Event	event;
 	
 	event.type = SDL_USEREVENT;
+	event.user.code = EVENT_LIVE;
 	SDL_PushEvent( &event );
 	return interval;
 }
 
+// runs on a search worker
+void	SearchDone( unsigned int generation )
+{
+	SDL_Event	event;
+	
+	event.type = SDL_USEREVENT;
+	event.user.code = EVENT_SEARCHED;
+	event.user.data1 = GUINT_TO_POINTER( generation );
+	SDL_PushEvent( &event );
+	return;
+}
+
+// runs on the render worker
+void	RenderDone( unsigned int generation )
+{
+	SDL_Event	event;
+	
+	event.type = SDL_USEREVENT;
+	event.user.code = EVENT_RENDERED;
+	event.user.data1 = GUINT_TO_POINTER( generation );
+	SDL_PushEvent( &event );
+	return;
+}
+
+// runs on a loader worker
+void	DocumentOpened( void )
+{
+	SDL_Event	event;
+	
+	event.type = SDL_USEREVENT;
+	event.user.code = EVENT_OPENED;
+	SDL_PushEvent( &event );
+	return;
+}
+
 int	Green_SDL_Main( Green_RTD *rtd )
 {
+	Green_Document	*doc;
 	SDL_TimerID	timer = NULL;
 	SDL_Surface	*display;
 	SDL_Event	event;
 	RState	state = NORMAL;
 	IBuffer	input;
-	Uint32	mouse_last = 0, mouse_cur;
+	Uint32	mouse_last = 0, mouse_cur, frame_last = 0, elapsed;
 	Uint16	left_x = 0, left_y = 0, right_x = 0, right_y = 0;
 	unsigned short	flags = FLAG_RENDER;
-	unsigned char	event_count;
+	unsigned int	event_count;
+	bool	pending;
 	char	*str;
 	long	tmp;
-	int	x, y, width, height;
+	int	x, y, width, height, page;
 	
 	if (SDL_Init( SDL_INIT_VIDEO | SDL_INIT_TIMER ))
 	{
@@ -575,6 +1334,7 @@ int	Green_SDL_Main( Green_RTD *rtd )
 		return 1;
 	}
 	
+	BlitInit();
 	SDL_WM_SetCaption( "green - the PDF reader", NULL );
 	display = SDL_SetVideoMode( rtd->width, rtd->height, 0, SDL_SWSURFACE | SDL_ANYFORMAT | SDL_RESIZABLE | (rtd->flags&GREEN_FULLSCREEN ? SDL_FULLSCREEN : 0) );
 	if (!display)
@@ -591,6 +1351,9 @@ int	Green_SDL_Main( Green_RTD *rtd )
                 return 3;
 	}
 	
+	rtd->prefetch.done = RenderDone;
+	rtd->search.done = SearchDone;
+	Green_LoaderStart( rtd, DocumentOpened );
 	timer = SDL_AddTimer( live_interval, live_timer, NULL );
 	mouse_last = SDL_GetTicks();
 	if (!rtd->mouse.visibility)
@@ -598,14 +1361,29 @@ int	Green_SDL_Main( Green_RTD *rtd )
 	
 	do
 	{
+		// input is applied to the view as it comes in, a frame is only rendered
+		// once the queue is drained, at most one per frame_interval
+		pending = false;
 		if (flags&FLAG_RENDER)
 		{
-			Render( rtd );
-			flags ^= FLAG_RENDER;
+			// what arrived while waiting for the interval goes into this frame too
+			elapsed = SDL_GetTicks() - frame_last;
+			if (elapsed < frame_interval)
+			{
+				SDL_Delay( frame_interval - elapsed );
+				pending = SDL_PollEvent( &event );
+			}
+			
+			if (!pending)
+			{
+				Render( rtd );
+				flags ^= FLAG_RENDER;
+				frame_last = SDL_GetTicks();
+			}
 		}
 		
 		event_count = 0;
-		if (!SDL_WaitEvent( &event ))
+		if (!pending && !SDL_WaitEvent( &event ))
 		{
 			SDL_Quit();
 			return -1;
@@ -620,7 +1398,19 @@ int	Green_SDL_Main( Green_RTD *rtd )
 					break;
 				case SDL_KEYDOWN:
 					if (event.key.keysym.sym == SDLK_ESCAPE)
+					{
 						state = NORMAL;
+						Green_SearchCancel( &rtd->search, NULL );
+						if (overview.active && Green_IsDocValid( rtd, rtd->doc_cur ))
+						{
+							// back to where the overview was opened
+							overview.active = false;
+							rtd->docs[rtd->doc_cur]->page_cur = overview.page;
+							flags |= FLAG_RENDER;
+						}
+					}
+					else if (overview.active)
+						OverviewInput( rtd, &event, &flags );
 					else if (event.key.keysym.sym == SDLK_RETURN)
 					{
 						if (!Green_IsDocValid( rtd, rtd->doc_cur ))
@@ -640,22 +1430,15 @@ int	Green_SDL_Main( Green_RTD *rtd )
 								flags |= FLAG_RENDER;
 								break;
 							case SEARCH:
+								// a new string may reuse the address of the old one
+								presented.doc = NULL;
 								free( rtd->docs[rtd->doc_cur]->search_str );
 								rtd->docs[rtd->doc_cur]->search_str = NULL;
 								if (!strlen( input.buff ))
 									break;
 								
 								rtd->docs[rtd->doc_cur]->search_str = strdup( input.buff );
-								tmp = Green_FindNext( rtd->docs[rtd->doc_cur], rtd->docs[rtd->doc_cur]->page_cur );
-								if (tmp < 0)
-								{
-									free( rtd->docs[rtd->doc_cur]->search_str );
-									rtd->docs[rtd->doc_cur]->search_str = NULL;
-									break;
-								}
-								
-								rtd->docs[rtd->doc_cur]->page_cur = tmp;
-								flags |= FLAG_RENDER;
+								Search( rtd, rtd->docs[rtd->doc_cur], rtd->docs[rtd->doc_cur]->page_cur, &flags );
 								break;
 							default:
 								break;
@@ -750,6 +1533,7 @@ int	Green_SDL_Main( Green_RTD *rtd )
 					if (Green_IsDocValid( rtd, rtd->doc_cur ))
 						Green_ValidateOffset( rtd->docs[rtd->doc_cur], display->w, display->h );
 					
+					Settle();
 					flags |= FLAG_RENDER;
 					break;
 				case SDL_MOUSEMOTION:
@@ -773,6 +1557,12 @@ int	Green_SDL_Main( Green_RTD *rtd )
 					switch (event.button.button)
 					{
 						case SDL_BUTTON_LEFT:
+							if (overview.active)
+							{
+								OverviewClick( rtd, event.button.x, event.button.y, &flags );
+								break;
+							}
+							
 							left_x = event.button.x;
 							left_y = event.button.y;
 							break;
@@ -781,12 +1571,26 @@ int	Green_SDL_Main( Green_RTD *rtd )
 							right_y = event.button.y;
 							break;
 						case SDL_BUTTON_WHEELDOWN:
+							if (overview.active)
+							{
+								OverviewScroll( rtd->docs[rtd->doc_cur], 1, &flags );
+								break;
+							}
+							
 							Green_Zoom( rtd->docs[rtd->doc_cur], display->w, display->h, rtd->docs[rtd->doc_cur]->finescale * rtd->zoomstep );
-							Render( rtd );
+							Settle();
+							flags |= FLAG_RENDER;
 							break;
 						case SDL_BUTTON_WHEELUP:
+							if (overview.active)
+							{
+								OverviewScroll( rtd->docs[rtd->doc_cur], -1, &flags );
+								break;
+							}
+							
 							Green_Zoom( rtd->docs[rtd->doc_cur], display->w, display->h, rtd->docs[rtd->doc_cur]->finescale / rtd->zoomstep );
-							Render( rtd );
+							Settle();
+							flags |= FLAG_RENDER;
 							break;
 					}
 					
@@ -809,6 +1613,60 @@ int	Green_SDL_Main( Green_RTD *rtd )
 					
 					break;
 				case SDL_USEREVENT:
+					if (event.user.code == EVENT_RENDERED)
+					{
+						// anything but the newest request is late and not shown
+						if (presented.draft && GPOINTER_TO_UINT( event.user.data1 ) == render_generation)
+							flags |= FLAG_RENDER;
+						
+						break;
+					}
+					else if (event.user.code == EVENT_SEARCHED)
+					{
+						if (Green_SearchResult( &rtd->search, GPOINTER_TO_UINT( event.user.data1 ), &doc, &page ))
+							SearchFound( doc, page, &flags );
+						
+						break;
+					}
+					else if (event.user.code == EVENT_OPENED)
+					{
+						if (Green_LoaderCollect( rtd ))
+							flags |= FLAG_RENDER;
+						
+						break;
+					}
+					else if (event.user.code == EVENT_THUMBS)
+					{
+						if (overview.active)
+							flags |= FLAG_RENDER;
+						
+						break;
+					}
+					else if (event.user.code == EVENT_SETTLED)
+					{
+						if (GPOINTER_TO_UINT( event.user.data1 ) != settle_generation)
+							break;
+						
+						settle_timer = NULL;
+						if (presented.draft)
+							flags |= FLAG_RENDER;
+						
+						break;
+					}
+					
+					// the frame of the old version of a reloaded document stays until the
+					// new one is drawn, but not once a later document may get its address
+					if (Green_ReloadPoll( rtd ))
+					{
+						if (overview.page >= rtd->docs[rtd->doc_cur]->page_count)
+							overview.page = rtd->docs[rtd->doc_cur]->page_count - 1;
+						
+						flags |= FLAG_RENDER;
+					}
+					
+					if (presented.doc && !Green_IsDocAlive( rtd, presented.doc ))
+						presented.doc = NULL;
+					
 					if (rtd->mouse.visibility > 0)
 					{
 						mouse_cur = SDL_GetTicks();
@@ -853,6 +1711,9 @@ int	Green_SDL_Main( Green_RTD *rtd )
 	}	while (!(flags&FLAG_QUIT));
 	
 	SDL_RemoveTimer( timer );
+	if (settle_timer)
+		SDL_RemoveTimer( settle_timer );
+	
 	SDL_Quit();
 	return 0;
 }
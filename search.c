@@ -0,0 +1,257 @@
+/* green - the PDF reader
+ * Copyright (C) 2009 Florian Tobias Schandinat
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 3.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include "green.h"
+
+
+#define SEARCH_CHUNK	8	// pages a worker takes at once
+#define SEARCH_THREADS	8	// upper limit of search workers
+
+
+bool	PageHasText( Green_Document *doc, PopplerDocument *pdoc, int page_nr, const char *str, const char *folded )
+{
+	PopplerPage	*page;
+	GList	*list;
+	bool	res;
+	
+	if (folded && page_nr < Green_IndexProgress( &doc->index ))
+		return Green_IndexFind( &doc->index, folded, page_nr, page_nr + 1 ) >= 0;
+	
+	page = poppler_document_get_page( pdoc, page_nr );
+	list = poppler_page_find_text( page, str );
+	g_object_unref( G_OBJECT( page ) );
+	res = list != NULL;
+	g_list_free_full( list, (void (*)( gpointer ))poppler_rectangle_free );
+	return res;
+}
+
+// true if the current search may hand out another chunk
+inline static
+bool	SearchHasWork( Green_Search *search )
+{
+	return search->doc && !search->cancel && search->next * SEARCH_CHUNK < search->doc->page_count
+		&& search->next * SEARCH_CHUNK < search->best;
+}
+
+// workers search chunks of positions in wrap order from start; a hit only
+// stops the chunks behind it, those before it still have to be searched
+gpointer	SearchThread( gpointer data )
+{
+	Green_Search	*search = data;
+	Green_Document	*doc;
+	PopplerDocument	*pdoc;
+	unsigned int	generation;
+	char	*str, *folded;
+	int	pos, end, start;
+	bool	stop;
+	
+	g_mutex_lock( &search->lock );
+	while (!search->quit)
+	{
+		if (!SearchHasWork( search ))
+		{
+			g_cond_wait( &search->cond, &search->lock );
+			continue;
+		}
+		
+		doc = search->doc;
+		str = search->str;
+		folded = search->folded;
+		start = search->start;
+		generation = search->generation;
+		pos = search->next++ * SEARCH_CHUNK;
+		end = pos + SEARCH_CHUNK < doc->page_count ? pos + SEARCH_CHUNK : doc->page_count;
+		search->active++;
+		g_mutex_unlock( &search->lock );
+		pdoc = Green_AcquireDocument( doc );
+		for (; pos < end && pdoc; pos++)
+		{
+			g_mutex_lock( &search->lock );
+			stop = search->cancel || search->generation != generation || pos >= search->best;
+			g_mutex_unlock( &search->lock );
+			if (stop)
+				break;
+			
+			if (PageHasText( doc, pdoc, (start + pos) % doc->page_count, str, folded ))
+			{
+				g_mutex_lock( &search->lock );
+				if (search->generation == generation && pos < search->best)
+					search->best = pos;
+				
+				g_mutex_unlock( &search->lock );
+				break;
+			}
+		}
+		
+		Green_ReleaseDocument( doc, pdoc );
+		g_mutex_lock( &search->lock );
+		search->active--;
+		
+		// the last worker out reports, everything before best has been searched by now
+		if (search->generation == generation && !search->cancel && !search->active && !SearchHasWork( search ))
+		{
+			search->result_doc = doc;
+			search->result = search->best < doc->page_count ? (start + search->best) % doc->page_count : -1;
+			search->doc = NULL;
+			free( search->str );
+			free( search->folded );
+			search->str = search->folded = NULL;
+			if (search->done)
+				search->done( generation );
+		}
+		
+		g_cond_broadcast( &search->cond );
+	}
+	
+	g_mutex_unlock( &search->lock );
+	return NULL;
+}
+
+void	Green_SearchInit( Green_Search *search )
+{
+	g_mutex_init( &search->lock );
+	g_cond_init( &search->cond );
+	search->threads = NULL;
+	search->thread_count = 0;
+	search->doc = NULL;
+	search->result_doc = NULL;
+	search->str = NULL;
+	search->folded = NULL;
+	search->generation = 0;
+	search->active = 0;
+	search->cancel = false;
+	search->quit = false;
+	search->done = NULL;
+	return;
+}
+
+void	Green_SearchStop( Green_Search *search )
+{
+	int	i;
+	
+	g_mutex_lock( &search->lock );
+	search->quit = true;
+	g_cond_broadcast( &search->cond );
+	g_mutex_unlock( &search->lock );
+	for (i = 0; i < search->thread_count; i++)
+		g_thread_join( search->threads[i] );
+	
+	free( search->threads );
+	free( search->str );
+	free( search->folded );
+	search->threads = NULL;
+	search->thread_count = 0;
+	return;
+}
+
+bool	SearchStartThreads( Green_Search *search )
+{
+	int	i, n = g_get_num_processors();
+	
+	if (search->thread_count)
+		return true;
+	
+	n = n < 1 ? 1 : n > SEARCH_THREADS ? SEARCH_THREADS : n;
+	if (!(search->threads = malloc( n * sizeof( *search->threads ) )))
+		return false;
+	
+	for (i = 0; i < n; i++)
+		if (!(search->threads[search->thread_count] = g_thread_try_new( "search", SearchThread, search, NULL )))
+			break;
+		else
+			search->thread_count++;
+	
+	return search->thread_count > 0;
+}
+
+// stop the search through doc, or any search if doc is NULL, and wait
+// until no worker uses the document any more
+void	Green_SearchCancel( Green_Search *search, Green_Document *doc )
+{
+	g_mutex_lock( &search->lock );
+	if (search->result_doc && (!doc || search->result_doc == doc))
+		search->result_doc = NULL;
+	
+	if (search->doc && (!doc || search->doc == doc))
+	{
+		search->cancel = true;
+		search->generation++;
+		while (search->active)
+			g_cond_wait( &search->cond, &search->lock );
+		
+		free( search->str );
+		free( search->folded );
+		search->str = search->folded = NULL;
+		search->doc = NULL;
+		search->cancel = false;
+	}
+	
+	g_mutex_unlock( &search->lock );
+	return;
+}
+
+// search doc->search_str from page start on in the background, replacing any running
+// search; returns the generation that search->done will report, 0 if there are no workers
+unsigned int	Green_SearchStart( Green_Search *search, Green_Document *doc, int start )
+{
+	unsigned int	res;
+	
+	if (!doc->search_str || !doc->page_count || !SearchStartThreads( search ))
+		return 0;
+	
+	Green_SearchCancel( search, NULL );
+	g_mutex_lock( &search->lock );
+	search->str = strdup( doc->search_str );
+	search->folded = Green_IndexFold( doc->search_str );
+	if (!search->str)
+	{
+		free( search->folded );
+		search->folded = NULL;
+		g_mutex_unlock( &search->lock );
+		return 0;
+	}
+	
+	// generation 0 means no search
+	if (!++search->generation)
+		search->generation++;
+	
+	search->doc = doc;
+	search->start = start % doc->page_count;
+	search->next = 0;
+	search->best = doc->page_count;
+	res = search->generation;
+	g_cond_broadcast( &search->cond );
+	g_mutex_unlock( &search->lock );
+	return res;
+}
+
+// fetch the result of the search with the given generation; false if it is outdated
+bool	Green_SearchResult( Green_Search *search, unsigned int generation, Green_Document **doc, int *page )
+{
+	bool	res;
+	
+	g_mutex_lock( &search->lock );
+	res = search->generation == generation && !search->doc && search->result_doc;
+	*doc = search->result_doc;
+	*page = search->result;
+	if (res)
+		search->result_doc = NULL;
+	
+	g_mutex_unlock( &search->lock );
+	return res;
+}
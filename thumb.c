@@ -0,0 +1,210 @@
+/* green - the PDF reader
+ * Copyright (C) 2009 Florian Tobias Schandinat
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 3.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdlib.h>
+#include <unistd.h>
+#ifdef __linux__
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#endif
+#include "green.h"
+
+
+// the page for the worker to make a thumbnail of next: those on the screen,
+// then the others by their distance to the screen; -1 if all are made
+int	ThumbNext( Green_Thumbnails *th, int count )
+{
+	int	i, d;
+	
+	for (i = th->first; i <= th->last && i < count; i++)
+		if (!th->thumbs[i].width)
+			return i;
+	
+	for (d = 1; th->last + d < count || th->first - d >= 0; d++)
+	{
+		if (th->last + d < count && !th->thumbs[th->last + d].width)
+			return th->last + d;
+		
+		if (th->first - d >= 0 && !th->thumbs[th->first - d].width)
+			return th->first - d;
+	}
+	
+	return -1;
+}
+
+// scale the page into a GREEN_THUMB_SIZE box, from the thumbnail embedded in
+// the file if there is one, and pack it to RGB565
+Green_Thumb	ThumbMake( PopplerPage *page )
+{
+	Green_Thumb	res = {NULL, 1, 1};
+	cairo_surface_t	*surface, *embedded;
+	cairo_t	*context;
+	guint32	*row;
+	double	pwidth, pheight, scale;
+	int	x, y, w, h, stride;
+	
+	poppler_page_get_size( page, &pwidth, &pheight );
+	scale = GREEN_THUMB_SIZE / (pwidth > pheight ? pwidth : pheight);
+	w = pwidth * scale > 1 ? pwidth * scale : 1;
+	h = pheight * scale > 1 ? pheight * scale : 1;
+	embedded = poppler_page_get_thumbnail( page );
+	if (embedded)
+	{
+		surface = cairo_image_surface_create( CAIRO_FORMAT_RGB24, w, h );
+		context = cairo_create( surface );
+		cairo_scale( context, (double)w / cairo_image_surface_get_width( embedded ),
+			(double)h / cairo_image_surface_get_height( embedded ) );
+		cairo_set_source_surface( context, embedded, 0, 0 );
+		cairo_pattern_set_filter( cairo_get_source( context ), CAIRO_FILTER_GOOD );
+		cairo_paint( context );
+		cairo_destroy( context );
+		cairo_surface_destroy( embedded );
+	}
+	else
+		surface = Green_RenderRegion( page, scale, 0, 0, w, h );
+	
+	cairo_surface_flush( surface );
+	if (cairo_surface_status( surface ) == CAIRO_STATUS_SUCCESS && (res.pixels = malloc( w * h * sizeof( *res.pixels ) )))
+	{
+		stride = cairo_image_surface_get_stride( surface );
+		for (y = 0; y < h; y++)
+		{
+			row = (guint32*)(cairo_image_surface_get_data( surface ) + y * stride);
+			for (x = 0; x < w; x++)
+				res.pixels[y*w+x] = (row[x] >> 8 & 0xF800) | (row[x] >> 5 & 0x07E0) | (row[x] >> 3 & 0x001F);
+		}
+		
+		res.width = w;
+		res.height = h;
+	}
+	
+	cairo_surface_destroy( surface );
+	return res;
+}
+
+gpointer	ThumbThread( gpointer data )
+{
+	Green_Document	*doc = data;
+	Green_Thumbnails	*th = &doc->thumbs;
+	PopplerDocument	*pdoc;
+	PopplerPage	*page;
+	Green_Thumb	thumb;
+	bool	visible;
+	int	page_nr;
+
+#ifdef __linux__
+	// thumbnails of pages nobody looks at must not slow down the page on the screen
+	setpriority( PRIO_PROCESS, syscall( SYS_gettid ), 19 );
+#endif
+	pdoc = Green_AcquireDocument( doc );
+	g_mutex_lock( &th->lock );
+	while (!th->quit && pdoc)
+	{
+		page_nr = ThumbNext( th, doc->page_count );
+		if (page_nr < 0)
+		{
+			g_cond_wait( &th->cond, &th->lock );
+			continue;
+		}
+		
+		g_mutex_unlock( &th->lock );
+		page = poppler_document_get_page( pdoc, page_nr );
+		thumb = ThumbMake( page );
+		g_object_unref( G_OBJECT( page ) );
+		g_mutex_lock( &th->lock );
+		th->thumbs[page_nr] = thumb;
+		visible = page_nr >= th->first && page_nr <= th->last;
+		if (visible && th->done)
+			th->done();
+	}
+	
+	g_mutex_unlock( &th->lock );
+	Green_ReleaseDocument( doc, pdoc );
+	return NULL;
+}
+
+void	Green_ThumbsInit( Green_Document *doc )
+{
+	Green_Thumbnails	*th = &doc->thumbs;
+	
+	g_mutex_init( &th->lock );
+	g_cond_init( &th->cond );
+	th->thread = NULL;
+	th->thumbs = NULL;
+	th->first = th->last = 0;
+	th->quit = false;
+	th->done = NULL;
+	return;
+}
+
+void	Green_ThumbsStop( Green_Document *doc )
+{
+	Green_Thumbnails	*th = &doc->thumbs;
+	int	i;
+	
+	if (th->thread)
+	{
+		g_mutex_lock( &th->lock );
+		th->quit = true;
+		g_cond_broadcast( &th->cond );
+		g_mutex_unlock( &th->lock );
+		g_thread_join( th->thread );
+	}
+	
+	if (th->thumbs)
+		for (i = 0; i < doc->page_count; i++)
+			free( th->thumbs[i].pixels );
+	
+	free( th->thumbs );
+	g_mutex_clear( &th->lock );
+	g_cond_clear( &th->cond );
+	th->thread = NULL;
+	th->thumbs = NULL;
+	return;
+}
+
+// tell the worker which pages are on the screen, starting it on first use
+void	Green_ThumbsShow( Green_Document *doc, int first, int last, void (*done)( void ) )
+{
+	Green_Thumbnails	*th = &doc->thumbs;
+	
+	if (!th->thumbs && !(th->thumbs = calloc( doc->page_count ? doc->page_count : 1, sizeof( *th->thumbs ) )))
+		return;
+	
+	g_mutex_lock( &th->lock );
+	th->first = first;
+	th->last = last;
+	th->done = done;
+	g_cond_signal( &th->cond );
+	g_mutex_unlock( &th->lock );
+	if (!th->thread)
+		th->thread = g_thread_try_new( "thumbnails", ThumbThread, doc, NULL );
+	
+	return;
+}
+
+// the thumbnail of the page, width 0 if it is not made yet
+Green_Thumb	Green_ThumbGet( Green_Thumbnails *th, int page )
+{
+	Green_Thumb	res = {NULL, 0, 0};
+	
+	g_mutex_lock( &th->lock );
+	if (th->thumbs)
+		res = th->thumbs[page];
+	
+	g_mutex_unlock( &th->lock );
+	return res;
+}
@@ -0,0 +1,371 @@
+/* green - the PDF reader
+ * Copyright (C) 2009 Florian Tobias Schandinat
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 3.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdlib.h>
+#include "green.h"
+
+
+// render a draft of the region for the ui to stretch until the tiles are done
+void	DraftCurrent( Green_Prefetch *pf, unsigned int generation, PopplerPage *page, double tscale, int x, int y, int w, int h )
+{
+	cairo_surface_t	*surface;
+	int	dx, dy;
+	
+	dx = x > 0 ? x / GREEN_DRAFT_FACTOR : 0;
+	dy = y > 0 ? y / GREEN_DRAFT_FACTOR : 0;
+	w = (x + w + GREEN_DRAFT_FACTOR - 1) / GREEN_DRAFT_FACTOR - dx;
+	h = (y + h + GREEN_DRAFT_FACTOR - 1) / GREEN_DRAFT_FACTOR - dy;
+	surface = Green_RenderRegion( page, tscale / GREEN_DRAFT_FACTOR, dx, dy, w, h );
+	cairo_surface_flush( surface );
+	g_mutex_lock( &pf->lock );
+	if (pf->draft)
+		cairo_surface_destroy( pf->draft );
+	
+	pf->draft = surface;
+	pf->draft_generation = generation;
+	pf->draft_x = dx;
+	pf->draft_y = dy;
+	g_mutex_unlock( &pf->lock );
+	if (pf->done)
+		pf->done( generation );
+	
+	return;
+}
+
+// called and returns with pf->lock held; a request replaced before it is
+// picked up is never rendered, the ui ignores results of replaced ones
+void	RenderCurrent( Green_Prefetch *pf )
+{
+	Green_Document	*doc;
+	PopplerDocument	*pdoc;
+	PopplerPage	*page;
+	unsigned int	generation;
+	int	page_nr, x, y, w, h;
+	double	tscale;
+	bool	draft, stale;
+	
+	doc = pf->busy = pf->cur_doc;
+	page_nr = pf->cur_page;
+	tscale = pf->cur_tscale;
+	x = pf->cur_x;
+	y = pf->cur_y;
+	w = pf->cur_w;
+	h = pf->cur_h;
+	draft = pf->cur_draft;
+	generation = pf->generation;
+	pf->cur_doc = NULL;
+	pf->cur_busy = true;
+	g_mutex_unlock( &pf->lock );
+	pdoc = Green_AcquireDocument( doc );
+	if (pdoc)
+	{
+		page = poppler_document_get_page( pdoc, page_nr );
+		if (draft)
+			DraftCurrent( pf, generation, page, tscale, x, y, w, h );
+		
+		g_mutex_lock( &pf->lock );
+		stale = pf->generation != generation;
+		g_mutex_unlock( &pf->lock );
+		if (!stale)
+			Green_RenderTiles( &doc->cache, page, page_nr, tscale, x, y, w, h );
+		
+		g_object_unref( G_OBJECT( page ) );
+		Green_ReleaseDocument( doc, pdoc );
+	}
+	
+	if (pf->done)
+		pf->done( generation );
+	
+	g_mutex_lock( &pf->lock );
+	pf->busy = NULL;
+	pf->cur_busy = false;
+	g_cond_broadcast( &pf->cond );
+	return;
+}
+
+gpointer	PrefetchThread( gpointer data )
+{
+	Green_Prefetch	*pf = data;
+	Green_Document	*doc;
+	PopplerDocument	*pdoc;
+	PopplerPage	*page;
+	int	i, pages[2], xs[2], ys[2], width, height;
+	double	tscales[2];
+	bool	stale;
+	
+	g_mutex_lock( &pf->lock );
+	while (!pf->quit)
+	{
+		if (pf->cur_doc)
+		{
+			RenderCurrent( pf );
+			continue;
+		}
+		
+		if (!pf->pending)
+		{
+			g_cond_wait( &pf->cond, &pf->lock );
+			continue;
+		}
+		
+		doc = pf->busy = pf->doc;
+		for (i = 0; i < 2; i++)
+		{
+			pages[i] = pf->page[i];
+			tscales[i] = pf->tscale[i];
+			xs[i] = pf->x[i];
+			ys[i] = pf->y[i];
+		}
+		
+		width = pf->width;
+		height = pf->height;
+		pf->pending = false;
+		g_mutex_unlock( &pf->lock );
+		pdoc = Green_AcquireDocument( doc );
+		for (i = 0; i < 2 && pdoc; i++)
+		{
+			g_mutex_lock( &pf->lock );
+			stale = pf->pending || pf->quit || pf->doc != doc || pf->cur_doc;
+			g_mutex_unlock( &pf->lock );
+			if (stale)
+				break;
+			
+			if (pages[i] < 0)
+				continue;
+			
+			page = poppler_document_get_page( pdoc, pages[i] );
+			Green_RenderTiles( &doc->cache, page, pages[i], tscales[i], xs[i], ys[i], width, height );
+			g_object_unref( G_OBJECT( page ) );
+		}
+		
+		Green_ReleaseDocument( doc, pdoc );
+		g_mutex_lock( &pf->lock );
+		pf->busy = NULL;
+		g_cond_broadcast( &pf->cond );
+	}
+	
+	g_mutex_unlock( &pf->lock );
+	return NULL;
+}
+
+void	Green_PrefetchInit( Green_Prefetch *pf )
+{
+	g_mutex_init( &pf->lock );
+	g_cond_init( &pf->cond );
+	pf->thread = NULL;
+	pf->doc = NULL;
+	pf->busy = NULL;
+	pf->pending = false;
+	pf->quit = false;
+	pf->cur_doc = NULL;
+	pf->cur_busy = false;
+	pf->generation = 0;
+	pf->draft = NULL;
+	pf->done = NULL;
+	return;
+}
+
+bool	PrefetchStart( Green_Prefetch *pf )
+{
+	if (!pf->thread)
+		pf->thread = g_thread_try_new( "prefetch", PrefetchThread, pf, NULL );
+	
+	return pf->thread != NULL;
+}
+
+void	Green_PrefetchStop( Green_Prefetch *pf )
+{
+	if (!pf->thread)
+		return;
+	
+	g_mutex_lock( &pf->lock );
+	pf->quit = true;
+	g_cond_broadcast( &pf->cond );
+	g_mutex_unlock( &pf->lock );
+	g_thread_join( pf->thread );
+	pf->thread = NULL;
+	if (pf->draft)
+		cairo_surface_destroy( pf->draft );
+	
+	pf->draft = NULL;
+	return;
+}
+
+// the screen of the pages below and above the display in continuous mode
+// that scrolls in first, as page regions
+void	ContinuousNeighbours( Green_Document *doc, int width, int height, int *pages, double *tscales, int *xs, int *ys )
+{
+	double	tscale = Green_Fit( doc, width, height ) * doc->finescale;
+	int	i, w, h, pos, dir_x, dir_y;
+	
+	pos = Green_PageTop( doc, doc->page_cur, tscale ) + doc->yoffset;
+	pages[0] = Green_PageAt( doc, pos + height, tscale ) + 1;
+	pages[1] = doc->page_cur - 1;
+	Green_GetDirection( doc, &dir_x, &dir_y );
+	for (i = 0; i < 2; i++)
+	{
+		if (pages[i] < 0 || pages[i] >= doc->page_count)
+			continue;
+		
+		// the top of the page below and the bottom of the one above, the
+		// display vertical being the page width if rotated
+		tscales[i] = tscale;
+		Green_GetPageDimension( doc, pages[i], &w, &h, tscale, doc->rotation % 2 );
+		xs[i] = ys[i] = 0;
+		if ((dir_y > 0) != (i == 0))
+		{
+			if (doc->rotation % 2)
+				xs[i] = h > height ? h - height : 0;
+			else
+				ys[i] = h > height ? h - height : 0;
+		}
+	}
+	
+	return;
+}
+
+// queue the first screen of the neighbours of the current page, or of the pages
+// beside the display in continuous mode, replacing any older request
+void	Green_PrefetchRequest( Green_RTD *rtd, Green_Document *doc, int width, int height )
+{
+	Green_Prefetch	*pf = &rtd->prefetch;
+	unsigned char	bb_mode;
+	int	i, dir, pages[2], xs[2] = {0, 0}, ys[2] = {0, 0};
+	double	tscales[2] = {0, 0};
+	
+	if (!PrefetchStart( pf ))
+		return;
+	
+	if (doc->continuous)
+		ContinuousNeighbours( doc, width, height, pages, tscales, xs, ys );
+	else
+	{
+		// read forward unless the active border behaviour turns pages backwards
+		bb_mode = doc->bb&0x0C ? (doc->bb>>2)&0x03 : doc->bb&0x03;
+		dir = bb_mode == 2 ? -1 : 1;
+		pages[0] = doc->page_cur + dir;
+		pages[1] = doc->page_cur - dir;
+		for (i = 0; i < 2; i++)
+			if (pages[i] >= 0 && pages[i] < doc->page_count)
+				tscales[i] = Green_FitPage( doc, pages[i], width, height ) * doc->finescale;
+	}
+	
+	for (i = 0; i < 2; i++)
+		if (pages[i] < 0 || pages[i] >= doc->page_count)
+			pages[i] = -1;
+	
+	g_mutex_lock( &pf->lock );
+	pf->doc = doc;
+	for (i = 0; i < 2; i++)
+	{
+		pf->page[i] = pages[i];
+		pf->tscale[i] = tscales[i];
+		pf->x[i] = xs[i];
+		pf->y[i] = ys[i];
+	}
+	
+	pf->width = doc->rotation % 2 ? height : width;
+	pf->height = doc->rotation % 2 ? width : height;
+	pf->pending = true;
+	g_cond_signal( &pf->cond );
+	g_mutex_unlock( &pf->lock );
+	return;
+}
+
+// queue the region (x, y, w, h) of the page the user is looking at, replacing
+// any older such request, with a draft first if asked for; returns the generation
+// that pf->done reports for it, 0 if there is no worker to render it
+unsigned int	Green_PrefetchCurrent( Green_Prefetch *pf, Green_Document *doc, int page, double tscale, int x, int y, int w, int h, bool draft )
+{
+	unsigned int	res;
+	
+	if (!PrefetchStart( pf ))
+		return 0;
+	
+	g_mutex_lock( &pf->lock );
+	
+	// asking again for what is queued or being rendered keeps it going
+	if ((pf->cur_doc == doc || (pf->cur_busy && pf->busy == doc)) && pf->cur_page == page && pf->cur_tscale == tscale
+		&& pf->cur_x == x && pf->cur_y == y && pf->cur_w == w && pf->cur_h == h)
+	{
+		if (pf->cur_doc)
+			pf->cur_draft |= draft;
+		
+		res = pf->generation;
+		g_mutex_unlock( &pf->lock );
+		return res;
+	}
+	
+	// generation 0 means no request
+	if (!++pf->generation)
+		pf->generation++;
+	
+	pf->cur_doc = doc;
+	pf->cur_page = page;
+	pf->cur_tscale = tscale;
+	pf->cur_x = x;
+	pf->cur_y = y;
+	pf->cur_w = w;
+	pf->cur_h = h;
+	pf->cur_draft = draft;
+	res = pf->generation;
+	g_cond_signal( &pf->cond );
+	g_mutex_unlock( &pf->lock );
+	return res;
+}
+
+// the draft made for the request with the given generation, with its position
+// in pixels at its scale; NULL if there is none (yet)
+cairo_surface_t*	Green_PrefetchDraft( Green_Prefetch *pf, unsigned int generation, int *x, int *y )
+{
+	cairo_surface_t	*res = NULL;
+	
+	g_mutex_lock( &pf->lock );
+	if (pf->draft && pf->draft_generation == generation)
+	{
+		res = cairo_surface_reference( pf->draft );
+		*x = pf->draft_x;
+		*y = pf->draft_y;
+	}
+	
+	g_mutex_unlock( &pf->lock );
+	return res;
+}
+
+// make sure the worker neither holds nor will pick up a request for doc
+void	Green_PrefetchCancel( Green_Prefetch *pf, Green_Document *doc )
+{
+	g_mutex_lock( &pf->lock );
+	if (pf->pending && pf->doc == doc)
+		pf->pending = false;
+	
+	if (pf->doc == doc)
+		pf->doc = NULL;
+	
+	if (pf->cur_doc == doc)
+		pf->cur_doc = NULL;
+	
+	while (pf->busy == doc)
+		g_cond_wait( &pf->cond, &pf->lock );
+	
+	// whoever it belongs to, it is only a draft
+	if (pf->draft)
+		cairo_surface_destroy( pf->draft );
+	
+	pf->draft = NULL;
+	g_mutex_unlock( &pf->lock );
+	return;
+}